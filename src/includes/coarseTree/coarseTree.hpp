@@ -1,5 +1,6 @@
 #pragma once
 #include <optional>
+#include <shared_mutex>
 #include "tree.h"
 #include "seqTree/seqNode.hpp"
 #include "seqTree/seqTree.hpp"
@@ -15,26 +16,26 @@ namespace Tree {
 
     template <typename T>
     std::optional<T> CoarseLockBPlusTree<T>::get(T key) {
-        std::lock_guard<std::mutex> guard(lock);
+        std::shared_lock<BRLock> guard(lock);
         return tree.get(key);
     }
 
     template <typename T>
     void CoarseLockBPlusTree<T>::insert(T key) {
-        std::lock_guard<std::mutex> guard(lock);
+        std::lock_guard<BRLock> guard(lock);
         tree.insert(key);
     }
 
     template <typename T>
     bool CoarseLockBPlusTree<T>::remove(T key) {
-        std::lock_guard<std::mutex> guard(lock);
+        std::lock_guard<BRLock> guard(lock);
         return tree.remove(key);
     }
 
     template <typename T>
     void CoarseLockBPlusTree<T>::print() {
         std::cout << "[Coarse Lock] " << std::endl;
-        std::lock_guard<std::mutex> guard(lock);
+        std::shared_lock<BRLock> guard(lock);
         tree.print();
     }
 
@@ -45,13 +46,50 @@ namespace Tree {
 
     template <typename T>
     bool CoarseLockBPlusTree<T>::debug_checkIsValid(bool verbose) {
-        std::lock_guard<std::mutex> guard(lock);
+        std::shared_lock<BRLock> guard(lock);
         return tree.debug_checkIsValid(verbose);
     }
 
     template <typename T>
     std::vector<T> CoarseLockBPlusTree<T>::toVec() {
-        std::lock_guard<std::mutex> guard(lock);
+        std::shared_lock<BRLock> guard(lock);
         return tree.toVec();
     }
+
+    template <typename T>
+    void CoarseLockBPlusTree<T>::forEach(const std::function<void(const T&)> &visitor) {
+        std::shared_lock<BRLock> guard(lock);
+        tree.forEach(visitor);
+    }
+
+    template <typename T>
+    MemoryStats CoarseLockBPlusTree<T>::memoryStats() {
+        std::shared_lock<BRLock> guard(lock);
+        MemoryStats stats = tree.memoryStats();
+        stats.otherBytes += sizeof(*this) - sizeof(tree);
+        return stats;
+    }
+
+    /** The whole run is applied under one lock acquisition. */
+    template <typename T>
+    void CoarseLockBPlusTree<T>::insertSorted(const std::vector<T> &keys) {
+        std::lock_guard<BRLock> guard(lock);
+        tree.insertSorted(keys);
+    }
+
+    template <typename T>
+    size_t CoarseLockBPlusTree<T>::eraseSorted(const std::vector<T> &keys) {
+        std::lock_guard<BRLock> guard(lock);
+        return tree.eraseSorted(keys);
+    }
+
+    template <typename T>
+    typename CoarseLockBPlusTree<T>::Iterator CoarseLockBPlusTree<T>::begin() {
+        return tree.begin();
+    }
+
+    template <typename T>
+    typename CoarseLockBPlusTree<T>::Iterator CoarseLockBPlusTree<T>::end() {
+        return tree.end();
+    }
 }
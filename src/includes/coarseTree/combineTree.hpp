@@ -0,0 +1,224 @@
+#pragma once
+#include <optional>
+#include <thread>
+#include "tree.h"
+#include "seqTree/seqNode.hpp"
+#include "seqTree/seqTree.hpp"
+
+/**
+ * @brief Flat-combining B+ tree (Hendler et al., "Flat Combining and the
+ * Synchronization-Parallelism Tradeoff", SPAA'10)
+ *
+ * Like CoarseLockBPlusTree, one SeqBPlusTree is protected by one mutex. Instead of every
+ * thread taking the lock for its own operation, a thread publishes the operation in its
+ * private slot and tries to become the combiner. The combiner applies all pending
+ * operations, sorted by key, and posts the results back into the slots while the other
+ * threads just spin on their own slot. Each operation is still its own descent.
+ */
+
+namespace Tree {
+    template <typename T>
+    std::atomic<uint64_t> CombineBPlusTree<T>::nextTreeId{0};
+
+    template <typename T>
+    CombineBPlusTree<T>::CombineBPlusTree(int order): tree(order), treeId(nextTreeId ++) {
+        pending.reserve(CombineMaxSlots);
+    }
+
+    template <typename T>
+    CombineBPlusTree<T>::~CombineBPlusTree() {}
+
+    template <typename T>
+    typename CombineBPlusTree<T>::Slot *CombineBPlusTree<T>::acquireSlot() {
+        /**
+         * The tree records which thread owns each slot, a thread only caches the slot of the
+         * last tree it used. Nothing outlives the tree, so a long run that builds many trees
+         * does not accumulate per-thread state.
+         *
+         * NOTE: Trees are identified by a unique id rather than by address, since a new tree
+         * may be allocated at the address of a destroyed one.
+         */
+        thread_local uint64_t cachedTree = UINT64_MAX;
+        thread_local Slot    *cachedSlot = nullptr;
+        if (cachedTree == treeId) return cachedSlot;
+
+        std::thread::id self = std::this_thread::get_id();
+        Slot *slot = nullptr;
+        size_t slotNum = std::min(numSlots.load(std::memory_order_acquire), CombineMaxSlots);
+        for (size_t idx = 0; idx < slotNum && slot == nullptr; idx ++) {
+            if (slots[idx].owner.load(std::memory_order_relaxed) == self) slot = &slots[idx];
+        }
+        if (slot == nullptr) {
+            size_t slotIdx = numSlots.fetch_add(1);
+            if (slotIdx >= CombineMaxSlots) return nullptr;
+            slot = &slots[slotIdx];
+            slot->owner.store(self, std::memory_order_relaxed);
+        }
+        cachedTree = treeId;
+        cachedSlot = slot;
+        return slot;
+    }
+
+    template <typename T>
+    void CombineBPlusTree<T>::apply(Slot *slot) {
+        switch (slot->op) {
+            case CombineOp::INSERT:
+                tree.insert(slot->key);
+                break;
+            case CombineOp::REMOVE:
+                slot->removed = tree.remove(slot->key);
+                break;
+            case CombineOp::GET:
+                slot->result = tree.get(slot->key);
+                break;
+        }
+    }
+
+    template <typename T>
+    void CombineBPlusTree<T>::combine() {
+        for (int pass = 0; pass < CombinePasses; pass ++) {
+            pending.clear();
+            size_t slotNum = std::min(numSlots.load(std::memory_order_acquire), CombineMaxSlots);
+            for (size_t idx = 0; idx < slotNum; idx ++) {
+                if (slots[idx].state.load(std::memory_order_acquire) == SlotState::PENDING)
+                    pending.push_back(&slots[idx]);
+            }
+            if (pending.empty()) return;
+
+            /** Insertion sort - there are at most CombineMaxSlots pending operations */
+            for (size_t i = 1; i < pending.size(); i ++) {
+                Slot *slot = pending[i];
+                size_t j = i;
+                while (j > 0 && slot->key < pending[j - 1]->key) {
+                    pending[j] = pending[j - 1];
+                    j --;
+                }
+                pending[j] = slot;
+            }
+
+            for (Slot *slot : pending) {
+                apply(slot);
+                slot->state.store(SlotState::DONE, std::memory_order_release);
+            }
+        }
+    }
+
+    template <typename T>
+    typename CombineBPlusTree<T>::Slot *CombineBPlusTree<T>::submit(CombineOp op, T key) {
+        Slot *slot = acquireSlot();
+        if (slot == nullptr) return nullptr;
+
+        slot->op  = op;
+        slot->key = key;
+        slot->state.store(SlotState::PENDING, std::memory_order_release);
+
+        while (slot->state.load(std::memory_order_acquire) != SlotState::DONE) {
+            if (lock.try_lock()) {
+                combine();
+                lock.unlock();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        return slot;
+    }
+
+    template <typename T>
+    std::optional<T> CombineBPlusTree<T>::get(T key) {
+        Slot *slot = submit(CombineOp::GET, key);
+        if (slot == nullptr) {
+            // More threads than slots, fall back to plain coarse locking
+            std::lock_guard<std::mutex> guard(lock);
+            return tree.get(key);
+        }
+        std::optional<T> result = slot->result;
+        slot->state.store(SlotState::IDLE, std::memory_order_relaxed);
+        return result;
+    }
+
+    template <typename T>
+    void CombineBPlusTree<T>::insert(T key) {
+        Slot *slot = submit(CombineOp::INSERT, key);
+        if (slot == nullptr) {
+            std::lock_guard<std::mutex> guard(lock);
+            tree.insert(key);
+            return;
+        }
+        slot->state.store(SlotState::IDLE, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    bool CombineBPlusTree<T>::remove(T key) {
+        Slot *slot = submit(CombineOp::REMOVE, key);
+        if (slot == nullptr) {
+            std::lock_guard<std::mutex> guard(lock);
+            return tree.remove(key);
+        }
+        bool removed = slot->removed;
+        slot->state.store(SlotState::IDLE, std::memory_order_relaxed);
+        return removed;
+    }
+
+    template <typename T>
+    void CombineBPlusTree<T>::print() {
+        std::cout << "[Flat Combining] " << std::endl;
+        std::lock_guard<std::mutex> guard(lock);
+        tree.print();
+    }
+
+    template <typename T>
+    int CombineBPlusTree<T>::size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.size();
+    }
+
+    template <typename T>
+    bool CombineBPlusTree<T>::debug_checkIsValid(bool verbose) {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.debug_checkIsValid(verbose);
+    }
+
+    template <typename T>
+    std::vector<T> CombineBPlusTree<T>::toVec() {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.toVec();
+    }
+
+    template <typename T>
+    void CombineBPlusTree<T>::forEach(const std::function<void(const T&)> &visitor) {
+        std::lock_guard<std::mutex> guard(lock);
+        tree.forEach(visitor);
+    }
+
+    /** The publication slots are charged to otherBytes, one cache line each. */
+    template <typename T>
+    MemoryStats CombineBPlusTree<T>::memoryStats() {
+        std::lock_guard<std::mutex> guard(lock);
+        MemoryStats stats = tree.memoryStats();
+        stats.otherBytes += sizeof(*this) - sizeof(tree) + containerBytes(pending);
+        return stats;
+    }
+
+    /** A run is already a batch, it bypasses the combiner and is applied under the lock. */
+    template <typename T>
+    void CombineBPlusTree<T>::insertSorted(const std::vector<T> &keys) {
+        std::lock_guard<std::mutex> guard(lock);
+        tree.insertSorted(keys);
+    }
+
+    template <typename T>
+    size_t CombineBPlusTree<T>::eraseSorted(const std::vector<T> &keys) {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.eraseSorted(keys);
+    }
+
+    template <typename T>
+    typename CombineBPlusTree<T>::Iterator CombineBPlusTree<T>::begin() {
+        return tree.begin();
+    }
+
+    template <typename T>
+    typename CombineBPlusTree<T>::Iterator CombineBPlusTree<T>::end() {
+        return tree.end();
+    }
+}
@@ -0,0 +1,410 @@
+#pragma once
+#include <optional>
+#include <utility>
+#include "tree.h"
+
+/**
+ * @brief Copy-on-write (path-copying) variant of the coarse-lock tree
+ *
+ * Nodes are immutable once published. A writer copies every node on the path from the root to
+ * the leaf it modifies (plus the siblings it borrows from / merges with), re-links the copies
+ * and publishes the new root in a single atomic store. Untouched subtrees are shared between
+ * versions through reference counts, so a version costs O(order * height) new nodes.
+ *
+ * Writers are serialized by writeLock. Readers never take it: they pin the current Version,
+ * and every node reachable from it stays alive (and unchanged) until the last reader drops it.
+ * Pinning is not lock-free: std::atomic_load / atomic_store on a shared_ptr go through a
+ * small pool of mutexes in libstdc++. Only the pointer copy is done under that lock, never the
+ * path copying of a write.
+ */
+
+namespace Tree {
+    template <typename T>
+    CowBPlusTree<T>::CowBPlusTree(int order): ORDER_(order), current(std::make_shared<const Version>()) {}
+
+    template <typename T>
+    CowBPlusTree<T>::~CowBPlusTree() {}
+
+    template <typename T>
+    typename CowBPlusTree<T>::Snapshot CowBPlusTree<T>::snapshot() const {
+        return Snapshot(std::atomic_load(&current));
+    }
+
+    template <typename T>
+    void CowBPlusTree<T>::publish(NodePtr root, int size) {
+        auto version = std::make_shared<Version>();
+        version->root    = std::move(root);
+        version->size    = size;
+        version->version = std::atomic_load(&current)->version + 1;
+        std::atomic_store(&current, std::shared_ptr<const Version>(std::move(version)));
+    }
+
+    template <typename T>
+    void CowBPlusTree<T>::insert(T key) {
+        std::lock_guard<std::mutex> guard(writeLock);
+        auto base = std::atomic_load(&current);
+        if (base->root == nullptr) {
+            auto leaf = std::make_shared<CowNode<T>>(true);
+            leaf->keys.push_back(key);
+            publish(std::move(leaf), 1);
+            return;
+        }
+
+        InsertResult result = insertRec(*base->root, key);
+        NodePtr root = std::move(result.node);
+        if (result.split.has_value()) {
+            // Root split, grow the tree by one level
+            auto newRoot = std::make_shared<CowNode<T>>(false);
+            newRoot->keys.push_back(result.split->first);
+            newRoot->children.push_back(std::move(root));
+            newRoot->children.push_back(std::move(result.split->second));
+            root = std::move(newRoot);
+        }
+        publish(std::move(root), base->size + 1);
+    }
+
+    template <typename T>
+    typename CowBPlusTree<T>::InsertResult CowBPlusTree<T>::insertRec(const CowNode<T> &node, T key) {
+        auto copy = std::make_shared<CowNode<T>>(node);
+        size_t index = copy->getGtKeyIdx(key);
+        if (copy->isLeaf) {
+            copy->keys.insert(copy->keys.begin() + index, key);
+        } else {
+            InsertResult child = insertRec(*copy->children[index], key);
+            copy->children[index] = std::move(child.node);
+            if (child.split.has_value()) {
+                copy->keys.insert(copy->keys.begin() + index, child.split->first);
+                copy->children.insert(copy->children.begin() + index + 1, std::move(child.split->second));
+            }
+        }
+
+        InsertResult result;
+        if (copy->numKeys() >= static_cast<size_t>(ORDER_)) result.split = splitNode(*copy);
+        result.node = std::move(copy);
+        return result;
+    }
+
+    /** Split a freshly copied node in place, returns the separator and the new right node. */
+    template <typename T>
+    std::pair<T, typename CowBPlusTree<T>::NodePtr> CowBPlusTree<T>::splitNode(CowNode<T> &node) {
+        auto right  = std::make_shared<CowNode<T>>(node.isLeaf);
+        size_t middle = node.numKeys() / 2;
+        T midKey      = node.keys[middle];
+
+        if (node.isLeaf) {
+            // Leaf separator is copied up, the right leaf keeps it
+            right->keys.assign(node.keys.begin() + middle, node.keys.end());
+        } else {
+            // Internal separator is moved up
+            right->keys.assign(node.keys.begin() + middle + 1, node.keys.end());
+            right->children.assign(node.children.begin() + middle + 1, node.children.end());
+            node.children.erase(node.children.begin() + middle + 1, node.children.end());
+        }
+        node.keys.erase(node.keys.begin() + middle, node.keys.end());
+        return {midKey, std::move(right)};
+    }
+
+    template <typename T>
+    bool CowBPlusTree<T>::remove(T key) {
+        std::lock_guard<std::mutex> guard(writeLock);
+        auto base = std::atomic_load(&current);
+        if (base->root == nullptr) return false;
+
+        // A miss copies nothing and publishes nothing
+        std::shared_ptr<CowNode<T>> root = removeRec(*base->root, key);
+        if (root == nullptr) return false;
+
+        if (root->isLeaf && root->numKeys() == 0) {
+            publish(nullptr, base->size - 1);
+        } else if (!root->isLeaf && root->numKeys() == 0) {
+            // Root lost its last separator, shrink the tree by one level
+            publish(root->children[0], base->size - 1);
+        } else {
+            publish(std::move(root), base->size - 1);
+        }
+        return true;
+    }
+
+    template <typename T>
+    std::shared_ptr<CowNode<T>> CowBPlusTree<T>::removeRec(const CowNode<T> &node, T key) {
+        if (node.isLeaf) {
+            auto it = std::lower_bound(node.keys.begin(), node.keys.end(), key);
+            if (it == node.keys.end() || *it != key) return nullptr;
+            auto copy = std::make_shared<CowNode<T>>(node);
+            copy->keys.erase(copy->keys.begin() + std::distance(node.keys.begin(), it));
+            return copy;
+        }
+
+        size_t index = node.getGtKeyIdx(key);
+        std::shared_ptr<CowNode<T>> child = removeRec(*node.children[index], key);
+        if (child == nullptr) return nullptr;
+
+        auto copy = std::make_shared<CowNode<T>>(node);
+        bool underflow = child->numKeys() < minKeys();
+        copy->children[index] = std::move(child);
+        if (underflow) fixUnderflow(*copy, index);
+        return copy;
+    }
+
+    /**
+     * children[index] of the (already copied) parent dropped below half full. Borrow from a
+     * sibling with the same parent if it can spare a key, otherwise merge with it. Siblings
+     * are shared with older versions, so they are copied before being modified.
+     */
+    template <typename T>
+    void CowBPlusTree<T>::fixUnderflow(CowNode<T> &parent, size_t index) {
+        if (index > 0 && parent.children[index - 1]->numKeys() > minKeys()) {
+            auto left = std::make_shared<CowNode<T>>(*parent.children[index - 1]);
+            auto node = std::make_shared<CowNode<T>>(*parent.children[index]);
+            if (node->isLeaf) {
+                node->keys.insert(node->keys.begin(), left->keys.back());
+                parent.keys[index - 1] = left->keys.back();
+            } else {
+                node->keys.insert(node->keys.begin(), parent.keys[index - 1]);
+                parent.keys[index - 1] = left->keys.back();
+                node->children.insert(node->children.begin(), left->children.back());
+                left->children.pop_back();
+            }
+            left->keys.pop_back();
+            parent.children[index - 1] = std::move(left);
+            parent.children[index]     = std::move(node);
+            return;
+        }
+
+        if (index + 1 < parent.numChild() && parent.children[index + 1]->numKeys() > minKeys()) {
+            auto node  = std::make_shared<CowNode<T>>(*parent.children[index]);
+            auto right = std::make_shared<CowNode<T>>(*parent.children[index + 1]);
+            if (node->isLeaf) {
+                node->keys.push_back(right->keys.front());
+                right->keys.erase(right->keys.begin());
+                parent.keys[index] = right->keys.front();
+            } else {
+                node->keys.push_back(parent.keys[index]);
+                parent.keys[index] = right->keys.front();
+                right->keys.erase(right->keys.begin());
+                node->children.push_back(right->children.front());
+                right->children.erase(right->children.begin());
+            }
+            parent.children[index]     = std::move(node);
+            parent.children[index + 1] = std::move(right);
+            return;
+        }
+
+        // Neither sibling can spare a key, merge the right one of the pair into the left one
+        size_t leftIdx = index > 0 ? index - 1 : index;
+        auto merged = std::make_shared<CowNode<T>>(*parent.children[leftIdx]);
+        const CowNode<T> &right = *parent.children[leftIdx + 1];
+        if (!merged->isLeaf) merged->keys.push_back(parent.keys[leftIdx]);
+        merged->keys.insert(merged->keys.end(), right.keys.begin(), right.keys.end());
+        merged->children.insert(merged->children.end(), right.children.begin(), right.children.end());
+
+        parent.keys.erase(parent.keys.begin() + leftIdx);
+        parent.children.erase(parent.children.begin() + leftIdx + 1);
+        parent.children[leftIdx] = std::move(merged);
+    }
+
+    template <typename T>
+    std::optional<T> CowBPlusTree<T>::get(T key) {
+        return snapshot().get(key);
+    }
+
+    template <typename T>
+    int CowBPlusTree<T>::size() {
+        return snapshot().size();
+    }
+
+    template <typename T>
+    void CowBPlusTree<T>::print() {
+        std::cout << "[Copy-on-Write] " << std::endl;
+        Snapshot view = snapshot();
+        std::cout << "Version " << view.version() << std::endl;
+        if (view.version_->root == nullptr) {
+            std::cout << "(Empty)" << std::endl;
+            return;
+        }
+        // Level order, nodes have no sibling links
+        std::vector<const CowNode<T>*> level = {view.version_->root.get()};
+        for (int levelCnt = 0; !level.empty(); levelCnt ++) {
+            std::vector<const CowNode<T>*> nextLevel;
+            std::cout << levelCnt << "\t| ";
+            for (const CowNode<T> *node : level) {
+                std::cout << "[";
+                for (size_t idx = 0; idx < node->numKeys(); idx ++) {
+                    std::cout << node->keys[idx];
+                    if (idx + 1 != node->numKeys()) std::cout << ",";
+                }
+                std::cout << "]<->";
+                for (auto &child : node->children) nextLevel.push_back(child.get());
+            }
+            std::cout << std::endl;
+            level.swap(nextLevel);
+        }
+        std::cout << std::endl;
+    }
+
+    template <typename T>
+    bool CowBPlusTree<T>::debug_checkIsValid(bool verbose) {
+        Snapshot view = snapshot();
+        const CowNode<T> *root = view.version_->root.get();
+        if (root == nullptr) return view.size() == 0;
+
+        int leafDepth = -1, keyCount = 0;
+        bool valid = checkNode(*root, std::nullopt, std::nullopt, 0, true, leafDepth, keyCount);
+        if (valid && keyCount != view.size()) {
+            std::cout << "FAIL: expect size " << view.size() << " actual leaf cnt " << keyCount << std::endl;
+            valid = false;
+        }
+        if (valid && verbose)
+            std::cout << "\033[1;32mPASS! tree is valid" << " \033[0m" << std::endl;
+        return valid;
+    }
+
+    /** Keys sorted within (lower, upper], node sizes within bounds, all leaves on one level. */
+    template <typename T>
+    bool CowBPlusTree<T>::checkNode(const CowNode<T> &node, std::optional<T> lower, std::optional<T> upper,
+                                    int depth, bool isRoot, int &leafDepth, int &keyCount) {
+        if (node.numKeys() >= static_cast<size_t>(ORDER_)) return false;
+        if (!isRoot && node.numKeys() < minKeys()) return false;
+        for (size_t idx = 0; idx < node.numKeys(); idx ++) {
+            if (idx > 0 && node.keys[idx] < node.keys[idx - 1]) return false;
+            if (lower.has_value() && node.keys[idx] < lower.value()) return false;
+            if (upper.has_value() && node.keys[idx] >= upper.value()) return false;
+        }
+
+        if (node.isLeaf) {
+            if (!node.children.empty()) return false;
+            if (leafDepth == -1) leafDepth = depth;
+            keyCount += node.numKeys();
+            return leafDepth == depth;
+        }
+
+        if (node.numKeys() == 0 || node.numChild() != node.numKeys() + 1) return false;
+        for (size_t idx = 0; idx < node.numChild(); idx ++) {
+            std::optional<T> childLower = idx == 0 ? lower : std::optional<T>(node.keys[idx - 1]);
+            std::optional<T> childUpper = idx == node.numKeys() ? upper : std::optional<T>(node.keys[idx]);
+            if (!checkNode(*node.children[idx], childLower, childUpper, depth + 1, false, leafDepth, keyCount))
+                return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    std::vector<T> CowBPlusTree<T>::toVec() {
+        return snapshot().toVec();
+    }
+
+    template <typename T>
+    void CowBPlusTree<T>::forEach(const std::function<void(const T&)> &visitor) {
+        snapshot().forEach(visitor);
+    }
+
+    /**
+     * Accounts the current version only, nodes kept alive by older snapshots are not counted.
+     * make_shared places every node right after its control block (vtable pointer and two
+     * reference counts), which is charged per node.
+     */
+    template <typename T>
+    MemoryStats CowBPlusTree<T>::memoryStats() {
+        Snapshot pinned = snapshot();
+        MemoryStats stats;
+        stats.maxKeysPerNode = ORDER_ - 1;
+        stats.otherBytes     = sizeof(*this) + sizeof(Version) + 2 * sizeof(void *);
+        if (pinned.version_->root != nullptr) {
+            collectMemoryStats(pinned.version_->root.get(), stats, 0, 2 * sizeof(void *));
+        }
+        return stats;
+    }
+
+    template <typename T>
+    typename CowBPlusTree<T>::Iterator CowBPlusTree<T>::begin() {
+        return snapshot().begin();
+    }
+
+    template <typename T>
+    typename CowBPlusTree<T>::Iterator CowBPlusTree<T>::end() {
+        return Iterator();
+    }
+
+    /**
+     * Snapshot
+     */
+    template <typename T>
+    std::optional<T> CowBPlusTree<T>::Snapshot::get(T key) const {
+        const CowNode<T> *node = version_->root.get();
+        if (node == nullptr) return std::nullopt;
+        while (!node->isLeaf) node = node->children[node->getGtKeyIdx(key)].get();
+        size_t index = node->getGtKeyIdx(key);
+        if (index > 0 && node->keys[index - 1] == key) return key;
+        return std::nullopt;
+    }
+
+    template <typename T>
+    std::vector<T> CowBPlusTree<T>::Snapshot::toVec() const {
+        std::vector<T> result;
+        result.reserve(version_->size);
+        forEach([&result](const T &key) { result.push_back(key); });
+        return result;
+    }
+
+    template <typename T>
+    void CowBPlusTree<T>::Snapshot::forEach(const std::function<void(const T&)> &visitor) const {
+        for (Iterator it = begin(), last = Iterator(); it != last; ++it) visitor(*it);
+    }
+
+    template <typename T>
+    typename CowBPlusTree<T>::Iterator CowBPlusTree<T>::Snapshot::begin() const {
+        return Iterator(version_);
+    }
+
+    /**
+     * Iterator, nodes have no leaf links so it keeps the path from the root
+     */
+    template <typename T>
+    CowBPlusTree<T>::Iterator::Iterator(std::shared_ptr<const Version> version): version(std::move(version)) {
+        if (this->version == nullptr || this->version->root == nullptr) return;
+        descend(this->version->root.get());
+    }
+
+    /** Push the left-most path of node, skipping past empty leaves. */
+    template <typename T>
+    void CowBPlusTree<T>::Iterator::descend(const CowNode<T> *node) {
+        for (; !node->isLeaf; node = node->children[0].get()) path.emplace_back(node, 0);
+        path.emplace_back(node, 0);
+        if (node->numKeys() == 0) advanceLeaf();
+    }
+
+    /** Move to the first key of the next leaf, path becomes empty at the end. */
+    template <typename T>
+    void CowBPlusTree<T>::Iterator::advanceLeaf() {
+        path.pop_back();
+        while (!path.empty() && path.back().second + 1 >= path.back().first->numChild()) path.pop_back();
+        if (path.empty()) return;
+        path.back().second ++;
+        descend(path.back().first->children[path.back().second].get());
+    }
+
+    template <typename T>
+    T CowBPlusTree<T>::Iterator::operator*() const {
+        DBG_ASSERT(!path.empty());
+        return path.back().first->keys[path.back().second];
+    }
+
+    template <typename T>
+    typename CowBPlusTree<T>::Iterator &CowBPlusTree<T>::Iterator::operator++() {
+        auto &leaf = path.back();
+        leaf.second ++;
+        if (leaf.second >= leaf.first->numKeys()) advanceLeaf();
+        return *this;
+    }
+
+    template <typename T>
+    bool CowBPlusTree<T>::Iterator::operator==(const Iterator &other) const {
+        if (path.empty() || other.path.empty()) return path.empty() && other.path.empty();
+        return path.back() == other.path.back();
+    }
+
+    template <typename T>
+    bool CowBPlusTree<T>::Iterator::operator!=(const Iterator &other) const {
+        return !(*this == other);
+    }
+}
@@ -1,20 +1,263 @@
 #pragma once
+#include <deque>
+#include <unordered_map>
 #include "tree.h"
 
 namespace Tree {
+    /**
+     * NOTE: Requests to a remote owner are buffered per destination rank and sent as one message
+     * once DistriBatchSize of them are pending, or at the latest DistriFlushInterval seconds later.
+     */
+    constexpr size_t DistriBatchSize     = 256;
+    constexpr double DistriFlushInterval = 0.0002;
+    constexpr size_t DistriMaxInFlight   = 64;      // Sends a SendPool lets in flight before senders wait
+    constexpr uint64_t DistriRebalanceFactor = 2;   // A rank serving this many times its share gets split
+    constexpr size_t DistriMirrorSlots   = 1 << 16; // Smallest shared-memory mirror of a rank, in keys
+    constexpr size_t DistriMirrorRun     = 8;       // Slots one MPI_Get of a remote mirror fetches
+    constexpr int    DistriMirrorRetries = 4;       // Torn mirror reads before a get falls back to a message
+    constexpr size_t DistriScanChunk     = 1024;    // Keys a rank streams back per scan message
+
+    /**
+     * How a get reaches a key owned by another rank (see NodeMirror)
+     * Messages   - a request to the owner's server thread and its reply
+     * NodeShared - loads from the mirror of an owner on the same node, a message otherwise
+     * OneSided   - MPI_Get from the mirror of any owner, the owner's CPU takes no part
+     * */
+    enum class RemoteRead {Messages, NodeShared, OneSided};
+
+    /**
+     * NOTE: Owns the buffer and the MPI_Request of every non-blocking send until it completes.
+     * A message is copied into a free slot and sent with MPI_Isend, completed slots are retired
+     * in bulk with MPI_Testsome and reused. With every slot in flight, send() retires until one
+     * frees up, which throttles the sender instead of piling up requests. A pool built with grow
+     * adds a slot instead, for senders that must never wait. Thread-safe.
+     */
+    class SendPool {
+        public:
+            SendPool(MPI_Comm world, size_t slots = DistriMaxInFlight, bool grow = false);
+            ~SendPool();    // Waits for every send in flight
+
+            void send(const void *data, int count, MPI_Datatype type, int dest, int tag);
+            /** Retire completed sends, returns how many completed. */
+            size_t retire();
+            void drain();
+            size_t inFlight();
+            uint64_t bytesSent();       // Payload bytes of every send so far
+            uint64_t messagesSent();
+
+        private:
+            MPI_Comm world;
+            bool grow;
+            std::mutex lock;
+            std::vector<MPI_Request>       requests;   // MPI_REQUEST_NULL for a free slot
+            std::vector<std::vector<char>> buffers;
+            std::vector<int>               freeSlots;
+            std::vector<int>               indices;    // Scratch for MPI_Testsome
+            uint64_t totalBytes    = 0;
+            uint64_t totalMessages = 0;
+
+            size_t retireLocked();
+    };
+
+    /**
+     * NOTE: Ranks on one node (MPI_COMM_TYPE_SHARED) each publish a hash set of the keys they own
+     * in an MPI_Win_allocate_shared segment, so a same-node peer answers a lookup with loads
+     * instead of a message round trip. The B+ tree holds process-local pointers and stays private,
+     * the segment is a mirror its owner updates along with the tree.
+     *
+     * A key's count says how many copies the tree holds. A removed key keeps its slot, so the
+     * probe chains stay intact, until a new key whose chain passes it takes the slot over. Once
+     * 3/4 of the slots are taken the owner rehashes the live keys in place. Only if they alone
+     * fill 3/4 does the mirror disable itself, until rebuild() sizes it for the tree again.
+     * applied[src] counts the writes from src the owner applied, a reader skips the mirror until
+     * all of its own writes are in. The counts are kept privately while a rank has no segment.
+     *
+     * Claiming or taking over a slot and rehashing bump the epoch to odd and back. A lookup reads
+     * the epoch, the slots the key probes into, then the epoch again, and reads again if a write
+     * came in between, so it takes no lock and never uses a half-written slot.
+     *
+     * OneSided also exposes every segment in a window over world. A remote lookup reads the
+     * owner's disabled flag, epoch and applied count, then the run of slots the key probes into,
+     * then the epoch again. The capacity of every mirror, the only part of the table above the
+     * slots, only changes in rebuild() and is cached there.
+     */
+    template <typename T>
+    class NodeMirror {
+        public:
+            enum class Probe {Hit, Miss, Unavailable};
+
+            NodeMirror(MPI_Comm world, RemoteRead mode = RemoteRead::NodeShared, size_t minSlots = DistriMirrorSlots);   // Collective over world
+            ~NodeMirror();      // Collective over world
+
+            bool sameNode(int rank) const;
+            /** Owner side, thread-safe. remove() only for a key the tree actually removed. */
+            void insert(T key);
+            void remove(T key);
+            void countApplied(int src);
+            /** Whether expected writes from src are applied. */
+            bool caughtUp(int src, uint64_t expected) const;
+            uint64_t appliedFrom(int src) const;
+            /** Collective over world: reallocate for keys and publish them, applied counts carry over. */
+            void rebuild(const std::vector<T> &keys);
+
+            /** Lookup in the mirror of rank as the mode allows, writesSent is how many writes we sent it. */
+            Probe lookup(int rank, T key, uint64_t writesSent) const;
+            uint64_t numTornReads() const;
+            size_t bytes() const;
+
+        private:
+            struct Header {
+                std::atomic<uint32_t> disabled;
+                std::atomic<uint32_t> epoch;    // Odd while a slot is being claimed
+                uint32_t mask;      // Slots - 1
+                uint64_t used;      // Slots taken, owner only
+            };
+            struct Slot {
+                std::atomic<uint32_t> used;
+                std::atomic<uint32_t> count;
+                T key;
+            };
+            struct SlotImage {      // A Slot as MPI_Get copies it
+                uint32_t used;
+                uint32_t count;
+                T key;
+            };
+
+            int rank;
+            int numProc;
+            RemoteRead mode;
+            size_t minSlots;
+            MPI_Comm world;
+            MPI_Comm nodeComm = MPI_COMM_NULL;
+            MPI_Win  win      = MPI_WIN_NULL;
+            MPI_Win  rmaWin   = MPI_WIN_NULL;   // OneSided, the same segments over world
+            std::vector<uint32_t> masks;        // OneSided, per world rank
+            mutable uint64_t tornReads = 0;
+            size_t   segmentBytes = 0;
+            std::vector<int>   nodeRankOf;  // World rank to rank in nodeComm, -1 off node
+            std::vector<char*> segments;    // Per node rank
+            std::unique_ptr<std::atomic<uint64_t>[]> localApplied;
+            std::atomic<uint64_t> *appliedCounts;  // In our segment, localApplied without one
+            std::mutex writeLock;
+
+            void allocate(size_t slots);
+            void release();
+            Header *header(char *segment) const {return reinterpret_cast<Header*>(segment);}
+            std::atomic<uint64_t> *appliedOf(char *segment) const {
+                return reinterpret_cast<std::atomic<uint64_t>*>(segment + sizeof(Header));
+            }
+            Slot *slotsOf(char *segment) const {
+                return reinterpret_cast<Slot*>(segment + sizeof(Header) + numProc * sizeof(std::atomic<uint64_t>));
+            }
+            Slot *find(T key, bool claim);     // Owner side, caller holds writeLock
+            bool rehash();                      // Owner side, caller holds writeLock
+            Probe probeSlots(char *segment, T key) const;
+            Probe remoteLookup(int rank, T key, uint64_t writesSent) const;
+    };
+
+    /**
+     * NOTE: The key domain is range-partitioned over the ranks of world, every key has exactly
+     * one owner rank which stores it in its internalTree. Operations on a key owned by another
+     * rank are sent point-to-point to the owner, operations on local keys never leave the rank.
+     *
+     * Every rank runs numServers server threads, each receiving on its own channel (tag) and
+     * applying its batches to the shared internalTree concurrently. A key always travels on
+     * channel channelOf(key), so the requests for one key stay in order. numServers must be the
+     * same on every rank.
+     *
+     * The bounds are a versioned routing table. rebalance() moves half of the hottest rank's keys
+     * to its colder neighbour and bumps the version on every rank. Requests carry the version they
+     * were routed with, a server holds back requests newer than its table and forwards the ones
+     * for keys its rank no longer owns.
+     *
+     * replicate() copies a hot range of one owner to further ranks. The owner ships every write
+     * into the range to its replicas in the same outbox batches as other requests, and reads of
+     * the range are served by whichever copy they are sent to. Keys of a replicated range all
+     * travel on channel 0, so the writes of one rank reach a replica in the order it sent them.
+     */
     template<typename T>
     class DistriBPlusTree {
         private:
+            struct PendingGet {
+                bool done = false;
+                std::optional<T> result;
+                uint64_t completedNs = 0;   // nowNs() when the result came in
+            };
+
+            /** The keys one rank streams back for a scan, a chunk at a time. */
+            struct ScanStream {
+                int rank;
+                std::deque<T> keys;     // Received, not yet merged
+                T resume;               // The next chunk starts at copy skip of resume
+                uint32_t skip = 0;
+                bool started  = false;  // Its first request went out
+                bool inFlight = false;
+                bool done = false;
+            };
+            struct ScanState {
+                T high;
+                std::vector<ScanStream> streams;
+                std::vector<std::pair<T, size_t>> heap;     // Head key of every stream with keys, min-heap
+                std::vector<size_t> empty;                  // Streams to refill before the next merge step
+            };
+
             int ORDER_;
             int RANK_;
             int NUM_PROC_;
+            int NUM_SERVER_;
             MPI_Comm WORLD_;
             FineLockBPlusTree<T> internalTree;
+            FineLockBPlusTree<T> replicaTree;   // Copies of other ranks' replicated ranges
+            NodeMirror<T> mirror;               // internalTree as other ranks read it
+            std::vector<T> bounds;      // rank i owns keys in [bounds[i - 1], bounds[i])
         
         public:
-            DistriBPlusTree(int order, MPI_Comm world);
+            /**
+             * ReadYourWrites - a replica only answers a read once it applied the reader's last
+             *                  write into the range, otherwise the read goes on to the owner
+             * Eventual       - a replica answers with whatever it has applied so far
+             * */
+            enum class ReadConsistency {ReadYourWrites, Eventual};
+
+            DistriBPlusTree(int order, MPI_Comm world, int numServers = 1, RemoteRead remoteReads = RemoteRead::NodeShared);
+            /** Split [keyLow, keyHigh] evenly over the ranks, keys outside go to the first / last rank. */
+            DistriBPlusTree(int order, MPI_Comm world, T keyLow, T keyHigh, int numServers = 1,
+                            RemoteRead remoteReads = RemoteRead::NodeShared);
             ~DistriBPlusTree();
 
+            int ownerOf(T key) const;
+            int channelOf(T key) const;
+
+            /**
+             * Collective over world: exchange the operations every rank served since the last call
+             * and, if the hottest rank served more than DistriRebalanceFactor times its share, move
+             * half of its keys to its colder neighbour. Returns whether keys were moved.
+             * NOTE: Requests still in flight to the old owner are forwarded and may be applied
+             * after requests sent to the new owner once rebalance() returns.
+             */
+            bool rebalance();
+            uint32_t routingVersion() const;
+            uint64_t numRebalances() const;
+
+            /**
+             * Collective over world: copy the keys in [low, high) to the copies - 1 ranks after their
+             * owner. The range is clipped to the owner of low and must not overlap a replicated one.
+             * A read of the range is served locally if this rank holds a copy fresh enough for mode,
+             * otherwise the reads go round robin over the owner and its replicas. Returns whether
+             * the range got replicated.
+             * NOTE: rebalance() drops every replica once it moves keys.
+             */
+            bool replicate(T low, T high, int copies, ReadConsistency mode = ReadConsistency::ReadYourWrites);
+            size_t numReplicas() const;
+
+            /**
+             * Collective over world: every rank passes its slice of the keys, in any order. The
+             * slices are sample sorted across the ranks, the splitters become the new bounds and
+             * every rank builds its internalTree bottom-up from the keys of its range.
+             * NOTE: Only on an empty tree, replicas are dropped.
+             */
+            void bulkLoad(std::vector<T> keys);
+
             bool debug_checkIsValid(bool verbose);
             int size();
 
@@ -22,40 +265,182 @@ namespace Tree {
             void remove(T key);
             void print();
             std::optional<T> get(T key);
+
+            /** Lookup in flight, a handle is resolved by the progress engine of its tree. */
+            class GetHandle {
+                public:
+                    bool ready();               // Progresses without blocking
+                    std::optional<T> wait();    // Flushes the request if still buffered and blocks
+                    uint64_t completedNs() const {return state->completedNs;}     // 0 until ready
+
+                private:
+                    friend class DistriBPlusTree;
+                    GetHandle(DistriBPlusTree *tree, int box, std::shared_ptr<PendingGet> state):
+                        tree(tree), box(box), state(std::move(state)) {}
+                    DistriBPlusTree *tree;
+                    int box;        // Client outbox the request was queued in
+                    std::shared_ptr<PendingGet> state;
+            };
+
+            /**
+             * Queue a lookup without waiting for it, gets to a remote owner are batched like writes.
+             * NOTE: get_async, get and the handles drive one progress engine per tree, only one
+             * thread per rank may use them at a time.
+             */
+            GetHandle get_async(T key);
+            /** Retire every result that has arrived, returns the number of gets resolved. */
+            size_t progress(bool block = false);
+
+            /**
+             * Keys of a scan in ascending order. The streams of the ranks are merged a key at a time,
+             * a stream asks for its next chunk once the last one arrived, so at most two chunks per
+             * rank are buffered or in flight.
+             * NOTE: Single-threaded like get_async. No rebalance() or bulkLoad() while one is open.
+             */
+            class ScanCursor {
+                public:
+                    std::optional<T> next();
+
+                private:
+                    friend class DistriBPlusTree;
+                    ScanCursor(DistriBPlusTree *tree, std::shared_ptr<ScanState> state):
+                        tree(tree), state(std::move(state)) {}
+                    DistriBPlusTree *tree;
+                    std::shared_ptr<ScanState> state;
+            };
+
+            /**
+             * Keys in [low, high), one sub-scan per rank whose partition overlaps the range. A scan
+             * observes every write this rank made before it.
+             */
+            ScanCursor scan(T low, T high);
             std::vector<T> toVec();
+            MemoryStats memoryStats();
+            /** Bytes this rank sent through its send pool: request batches, replies and control messages. */
+            uint64_t bytesSent();
+            /** Gets this rank answered from the NodeMirror of a same-node owner. */
+            uint64_t numMirrorHits() const;
         
         private:
             /**
-             * GET, REMOVE - literally get and remove request
+             * INSERT, GET, REMOVE - operations forwarded to the owner of the key
              * STOP - Tell other distributed trees "I'm going to terminate"
+             * REPLICA_INSERT, REPLICA_REMOVE - a write the owner applied, shipped to a replica
+             * SCAN, SCAN_MORE - the first and the following chunks of a sub-scan, answered on ScanTAG
              * */
-            enum RequestType {GET, REMOVE, STOP, ACK};
+            enum RequestType {INSERT, GET, REMOVE, STOP, ACK, REPLICA_INSERT, REPLICA_REMOVE, SCAN, SCAN_MORE};
             struct Tree_Request {
                 int src_rank;
                 RequestType op;
                 T key;
+                T high{};                // SCAN: end of the range, exclusive
+                uint32_t ticket  = 0;    // Echoed in the Tree_Result of a GET, in the chunk of a SCAN
+                uint32_t version = 0;    // Routing table version the sender routed with
+                uint32_t stamp   = 0;    // Write: src_rank's count of writes to the owner's replicated
+                                         // ranges. Read: the stamp a replica must have applied
+                                         // SCAN: writes src_rank sent this rank (low 32 bits)
+                                         // SCAN_MORE: copies of key src_rank already has
+            };
+
+            /** Heads a chunk message, the keys follow. */
+            struct Scan_Chunk {
+                uint32_t ticket;
+                uint32_t more;          // Keys of the range remain after this chunk
+            };
+
+            struct ReplicaRange {
+                T low, high;
+                int owner;
+                std::vector<int> ranks;     // Ranks holding a copy, the owner excluded
+                ReadConsistency mode;
+                uint32_t lastWrite = 0;     // Stamp of this rank's last write into the range
+                size_t cursor = 0;          // Round robin over the owner and ranks
             };
 
             struct Tree_Result {
+                uint32_t ticket;
                 std::optional<T> result;
             };
 
+            /** Requests buffered for one destination rank, sent as a single message. */
+            struct Outbox {
+                std::mutex lock;
+                std::vector<Tree_Request> requests;
+            };
+
+            /**
+             * Outboxes and the pool they are sent through. A request batch is large enough to need
+             * its receiver's server before it completes, so a server must never wait for a slot:
+             * servers send through their own lane, whose pool grows, and keep receiving however
+             * backed up the client's sends are.
+             */
+            struct Lane {
+                Lane(MPI_Comm world, bool grow): pool(world, DistriMaxInFlight, grow) {}
+                SendPool pool;
+                std::vector<std::unique_ptr<Outbox>> outboxes;   // outboxes[dest * NUM_SERVER_ + channel]
+            };
+
             struct Background_Args {
                 int numProc;
                 int rank;
+                int channel;
+                DistriBPlusTree *tree;
                 MPI_Comm world;
                 MPI_Datatype TREE_REQUEST;
                 MPI_Datatype TREE_RESULT;
                 FineLockBPlusTree<T> *internalTree;
+                SendPool *sendPool;
             };
 
             MPI_Datatype TREE_REQUEST;
             MPI_Datatype TREE_RESULT;
-            MPI_Request garbage_request;
-            Background_Args *bg_args;
-            pthread_t bg_thread;
+            Lane client;    // The caller's requests and the flusher, throttled by its pool
+            Lane server;    // Replies, forwards and replica writes of the server threads
+            std::vector<Background_Args> bg_args;   // One per server channel
+            std::vector<pthread_t> bg_threads;
+
+            // Routing table, servers read bounds under routeLock shared, rebalance() writes it exclusively
+            BRLock routeLock;
+            std::atomic<uint32_t> routeVersion{0};
+            std::atomic<uint64_t> servedOps{0};
+            uint64_t rebalances = 0;
+            uint64_t mirrorHits = 0;
+
+            // Replicated ranges, the same on every rank and written under routeLock exclusively
+            std::vector<ReplicaRange> replicas;
+            std::vector<uint32_t> writeStamps;      // Per owner, writes this rank sent into its replicated ranges
+            std::vector<uint64_t> writesSent;       // Per owner, every write this rank sent it (see NodeMirror)
+            std::unique_ptr<std::atomic<uint32_t>[]> applied;   // [owner * NUM_PROC_ + src], last stamp applied here (as owner or replica)
+            std::atomic<bool> stopFlusher{false};
+            pthread_t flush_thread;
+
+            // Progress engine, one posted receive of a result batch per peer
+            uint32_t nextTicket = 0;
+            std::unordered_map<uint32_t, std::shared_ptr<PendingGet>> pending;
+            std::unordered_map<uint32_t, std::pair<std::shared_ptr<ScanState>, size_t>> pendingScans;  // Stream by ticket
+            std::vector<std::vector<Tree_Result>> resultBuffers;
+            std::vector<MPI_Request> resultRequests;
         
         private:
             static void *MPI_background(void *args);
+            static void *MPI_flusher(void *args);
+            int  enqueue(Lane &lane, int dest, const Tree_Request &request, bool flushNow);     // Returns the outbox used
+            void flush(Lane &lane, int box);      // Caller holds lane.outboxes[box]->lock
+            void flushLane(Lane &lane);
+            void postResultRecv(int src);
+            void forward(Tree_Request request);     // Caller holds routeLock shared
+            int  replicaOf(T key) const;            // Index into replicas, -1 if key is not replicated
+            bool replicaFresh(T key, int src, uint32_t stamp) const;
+            bool ownerObserves(const Tree_Request &request) const;     // Owner applied the reader's last write
+            void stampWrite(Tree_Request &request);
+            void propagate(Tree_Request request, Lane &lane);   // Ship a write the owner applied to the replicas
+            void applyReplica(const Tree_Request &request, int owner);
+            void dropReplicas();                    // Caller holds routeLock exclusively
+            bool scanObserves(const Tree_Request &request) const;      // Owner applied the scanner's writes
+            void serveScan(const Tree_Request &request);                // Caller holds routeLock shared
+            bool scanChunk(T resume, uint32_t skip, T high, std::vector<T> &out);   // Returns whether keys remain
+            void requestChunk(const std::shared_ptr<ScanState> &state, size_t idx);
+            void receiveChunk(int src);
+            void appendChunk(ScanStream &stream, const T *keys, size_t count, bool more);
     };
 };
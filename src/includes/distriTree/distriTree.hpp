@@ -1,25 +1,50 @@
 #pragma once
 
+#include <limits>
+#include <cstring>
+#include <numeric>
 #include <optional>
+#include <algorithm>
+#include <unistd.h>
+#include <sched.h>
 #include <pthread.h>
 #include "mpi.h"
 #include "tree.h"
 #include "fineTree/fineTree.hpp"
 #include "fineTree/fineNode.hpp"
 #include "distriTree.h"
+#include "sendPool.hpp"
+#include "nodeMirror.hpp"
 
-constexpr int RequestTAG  = 1;
 constexpr int ResultTAG   = 2;
 constexpr int AckTAG      = 3;
+constexpr int MigrateTAG  = 4;
+constexpr int ReplicaTAG  = 5;
+constexpr int ScanTAG     = 6;
+constexpr int ChannelTAG  = 16;     // Server channel c receives its requests on ChannelTAG + c
 
 
 namespace Tree {
 
 template <typename T>
-DistriBPlusTree<T>::DistriBPlusTree(int order, MPI_Comm world): 
-ORDER_(order), WORLD_(world), internalTree(FineLockBPlusTree<T>(order)) {
+DistriBPlusTree<T>::DistriBPlusTree(int order, MPI_Comm world, int numServers, RemoteRead remoteReads):
+DistriBPlusTree(order, world, std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max(), numServers, remoteReads) {}
+
+template <typename T>
+DistriBPlusTree<T>::DistriBPlusTree(int order, MPI_Comm world, T keyLow, T keyHigh, int numServers, RemoteRead remoteReads): 
+ORDER_(order), NUM_SERVER_(std::max(numServers, 1)), WORLD_(world), internalTree(FineLockBPlusTree<T>(order)),
+replicaTree(FineLockBPlusTree<T>(order)), mirror(world, remoteReads), client(world, false), server(world, true) {
     MPI_Comm_rank(WORLD_, &RANK_);
     MPI_Comm_size(WORLD_, &NUM_PROC_);
+    writeStamps.assign(NUM_PROC_, 0);
+    writesSent.assign(NUM_PROC_, 0);
+    applied.reset(new std::atomic<uint32_t>[NUM_PROC_ * NUM_PROC_]());
+
+    // Every rank computes the same bounds, so no exchange is needed
+    long double span = static_cast<long double>(keyHigh) - static_cast<long double>(keyLow) + 1;
+    for (int idx = 1; idx < NUM_PROC_; idx ++) {
+        bounds.push_back(static_cast<T>(keyLow + span * idx / NUM_PROC_));
+    }
 
     MPI_Type_contiguous(sizeof(Tree_Request), MPI_CHAR, &TREE_REQUEST);
     MPI_Type_contiguous(sizeof(Tree_Result), MPI_CHAR, &TREE_RESULT);
@@ -27,15 +52,79 @@ ORDER_(order), WORLD_(world), internalTree(FineLockBPlusTree<T>(order)) {
     MPI_Type_commit(&TREE_REQUEST);
     MPI_Type_commit(&TREE_RESULT);
     
-    bg_args = new Background_Args();
-    bg_args->internalTree = &internalTree;
-    bg_args->world        = WORLD_;
-    bg_args->TREE_REQUEST = TREE_REQUEST;
-    bg_args->TREE_RESULT  = TREE_RESULT;
-    bg_args->numProc      = NUM_PROC_;
-    bg_args->rank         = RANK_;
+    bg_args.resize(NUM_SERVER_);
+    for (int channel = 0; channel < NUM_SERVER_; channel ++) {
+        Background_Args &args = bg_args[channel];
+        args.internalTree = &internalTree;
+        args.sendPool     = &server.pool;
+        args.world        = WORLD_;
+        args.TREE_REQUEST = TREE_REQUEST;
+        args.TREE_RESULT  = TREE_RESULT;
+        args.numProc      = NUM_PROC_;
+        args.rank         = RANK_;
+        args.channel      = channel;
+        args.tree         = this;
+    }
+
+    for (int idx = 0; idx < NUM_PROC_ * NUM_SERVER_; idx ++) {
+        client.outboxes.emplace_back(new Outbox());
+        server.outboxes.emplace_back(new Outbox());
+    }
+
+    resultBuffers.resize(NUM_PROC_);
+    resultRequests.assign(NUM_PROC_, MPI_REQUEST_NULL);
+    for (int src = 0; src < NUM_PROC_; src ++) {
+        if (src == RANK_) continue;
+        resultBuffers[src].resize(DistriBatchSize);
+        postResultRecv(src);
+    }
+
+    bg_threads.resize(NUM_SERVER_);
+    for (int channel = 0; channel < NUM_SERVER_; channel ++) {
+        pthread_create(&bg_threads[channel], NULL, MPI_background, &bg_args[channel]);
+    }
+    pthread_create(&flush_thread, NULL, MPI_flusher, this);
+}
+
+/**
+ * NOTE: Sends whatever is buffered every DistriFlushInterval, so a request never waits longer
+ * than that for its batch to fill up.
+ * */
+template <typename T>
+void *DistriBPlusTree<T>::MPI_flusher(void *args) {
+    DistriBPlusTree<T> *tree = static_cast<DistriBPlusTree<T>*>(args);
+    while (!tree->stopFlusher.load(std::memory_order_acquire)) {
+        usleep(static_cast<useconds_t>(DistriFlushInterval * 1000000));
+        tree->flushLane(tree->server);
+        tree->flushLane(tree->client);
+    }
+    return nullptr;
+}
+
+template <typename T>
+void DistriBPlusTree<T>::flush(Lane &lane, int box) {
+    std::vector<Tree_Request> &requests = lane.outboxes[box]->requests;
+    if (requests.empty()) return;
+    int dest = box / NUM_SERVER_, channel = box % NUM_SERVER_;
+    lane.pool.send(requests.data(), static_cast<int>(requests.size()), TREE_REQUEST, dest, ChannelTAG + channel);
+    requests.clear();
+}
+
+template <typename T>
+void DistriBPlusTree<T>::flushLane(Lane &lane) {
+    for (size_t box = 0; box < lane.outboxes.size(); box ++) {
+        std::lock_guard<std::mutex> guard(lane.outboxes[box]->lock);
+        flush(lane, box);
+    }
+}
 
-    pthread_create(&bg_thread, NULL, MPI_background, bg_args);
+template <typename T>
+int DistriBPlusTree<T>::enqueue(Lane &lane, int dest, const Tree_Request &request, bool flushNow) {
+    int box = dest * NUM_SERVER_ + channelOf(request.key);
+    std::lock_guard<std::mutex> guard(lane.outboxes[box]->lock);
+    lane.outboxes[box]->requests.push_back(request);
+    if (flushNow || lane.outboxes[box]->requests.size() >= DistriBatchSize) flush(lane, box);
+    return box;
 }
 
 template <typename T>
@@ -44,45 +133,122 @@ void *DistriBPlusTree<T>::MPI_background(void *args) {
 
     int nProc = bg_args_recv->numProc;
     int rank  = bg_args_recv->rank;
+    int tag   = ChannelTAG + bg_args_recv->channel;
     MPI_Comm world = bg_args_recv->world;
     MPI_Datatype _TREE_REQUEST = (bg_args_recv->TREE_REQUEST);
     MPI_Datatype _TREE_RESULT  = (bg_args_recv->TREE_RESULT);
     FineLockBPlusTree<T>* internalTree = bg_args_recv->internalTree;
+    SendPool *sendPool = bg_args_recv->sendPool;
+    DistriBPlusTree<T> *tree = bg_args_recv->tree;
     DBG_PRINT(std::cout << "BG Thread Start with rank: " << rank << std::endl;);
     
-    // Count number of process sending "STOP" Request. Terminate this if and only if 
-    // all processes STOPs.
+    // Count number of process sending "STOP" Request on this channel. Terminate this if and
+    // only if all processes STOPs.
     int terminateCounter = 0;
-    MPI_Request  isend_handle;
+    std::vector<Tree_Request> batch;
+    std::vector<std::vector<Tree_Result>> results(nProc);    // Per requester, forwarded GETs come from a third rank
+    std::vector<Tree_Request> deferred;     // GETs that overtook the reader's own write, see ownerObserves
     
     while (true) {
         if (terminateCounter == nProc) break;
-        Tree_Request request;
-        Tree_Result  result;
-
-        // Receive a request from others
-        MPI_Recv(&request, 1, _TREE_REQUEST, MPI_ANY_SOURCE, RequestTAG, world, MPI_STATUS_IGNORE);
-        switch(request.op) {
-            case RequestType::GET:
-                result.result = internalTree->get(request.key);
-                MPI_Isend(&result, 1, _TREE_RESULT, request.src_rank, ResultTAG, world, &isend_handle);
-                break;
-            case RequestType::REMOVE:
-                internalTree->remove(request.key);
-                break;
-            case RequestType::STOP:
-                terminateCounter ++;
-                /**
-                 * After receiving a stop, acknowledge the sender.
-                 * */
-                Tree_Request ack_request;
-                ack_request.op = RequestType::ACK;
-                ack_request.src_rank = rank;
-                MPI_Isend(&ack_request, 1, _TREE_REQUEST, request.src_rank, AckTAG, world, &isend_handle);
-                // MPI_Send(&ack_request, 1, _TREE_REQUEST, request.src_rank, AckTAG, world);
-                break;
-            default:
-                assert(false);
+        Tree_Request ack_request;
+
+        // Receive a batch of requests from others, its size is only known after probing
+        MPI_Status status;
+        int count;
+        // Only this thread receives on tag, so the probed message is still there for the MPI_Recv
+        MPI_Probe(MPI_ANY_SOURCE, tag, world, &status);
+        MPI_Get_count(&status, _TREE_REQUEST, &count);
+        batch.resize(count);
+        MPI_Recv(batch.data(), count, _TREE_REQUEST, status.MPI_SOURCE, tag, world, MPI_STATUS_IGNORE);
+
+        // A batch routed with a newer table than ours waits until this rank has caught up
+        uint32_t newest = 0;
+        for (Tree_Request &request : batch) newest = std::max(newest, request.version);
+        std::shared_lock<BRLock> routeGuard(tree->routeLock);
+        while (newest > tree->routeVersion.load(std::memory_order_acquire)) {
+            routeGuard.unlock();
+            sched_yield();
+            routeGuard.lock();
+        }
+
+        // Apply the batch in one pass, the results of its GETs go back in as few messages as fit
+        for (std::vector<Tree_Result> &replies : results) replies.clear();
+        uint64_t served = 0;
+        for (Tree_Request &request : batch) {
+            bool isKeyOp = request.op == RequestType::INSERT || request.op == RequestType::GET ||
+                           request.op == RequestType::REMOVE;
+            if (isKeyOp && tree->ownerOf(request.key) != rank) {
+                if (request.op == RequestType::GET && tree->replicaFresh(request.key, request.src_rank, request.stamp)) {
+                    served ++;
+                    results[request.src_rank].push_back({request.ticket, tree->replicaTree.get(request.key)});
+                    continue;
+                }
+                // Routed with an older table or a replica too stale for the read, the owner answers
+                tree->forward(request);
+                continue;
+            }
+            served += isKeyOp;
+            switch(request.op) {
+                case RequestType::INSERT:
+                    internalTree->insert(request.key);
+                    tree->mirror.insert(request.key);
+                    tree->mirror.countApplied(request.src_rank);
+                    tree->propagate(request, tree->server);
+                    break;
+                case RequestType::GET:
+                    if (!tree->ownerObserves(request)) deferred.push_back(request);
+                    else results[request.src_rank].push_back({request.ticket, internalTree->get(request.key)});
+                    break;
+                case RequestType::REMOVE:
+                    if (internalTree->remove(request.key)) tree->mirror.remove(request.key);
+                    tree->mirror.countApplied(request.src_rank);
+                    tree->propagate(request, tree->server);
+                    break;
+                case RequestType::REPLICA_INSERT:
+                case RequestType::REPLICA_REMOVE:
+                    tree->applyReplica(request, status.MPI_SOURCE);
+                    break;
+                case RequestType::SCAN:
+                case RequestType::SCAN_MORE:
+                    // The writes waited for were sent before the scan, other channels are applying them.
+                    // They need routeLock too, so let a pending migration through while waiting
+                    while (!tree->scanObserves(request)) {
+                        routeGuard.unlock();
+                        sched_yield();
+                        routeGuard.lock();
+                    }
+                    tree->serveScan(request);
+                    break;
+                case RequestType::STOP:
+                    terminateCounter ++;
+                    /**
+                     * After receiving a stop, acknowledge the sender.
+                     * */
+                    ack_request.op = RequestType::ACK;
+                    ack_request.src_rank = rank;
+                    sendPool->send(&ack_request, 1, _TREE_REQUEST, request.src_rank, AckTAG);
+                    break;
+                default:
+                    assert(false);
+            }
+        }
+        // Retried as the writes they wait for come in, the reader's outbox is flushed periodically
+        size_t kept = 0;
+        for (Tree_Request &request : deferred) {
+            if (!tree->ownerObserves(request))             deferred[kept ++] = request;
+            else if (tree->ownerOf(request.key) != rank)   tree->forward(request);
+            else results[request.src_rank].push_back({request.ticket, internalTree->get(request.key)});
+        }
+        deferred.resize(kept);
+        routeGuard.unlock();
+        tree->servedOps.fetch_add(served, std::memory_order_relaxed);
+        // Held back GETs add to the batch's own, a reply never holds more than the requester receives
+        for (int src = 0; src < nProc; src ++) {
+            for (size_t first = 0; first < results[src].size(); first += DistriBatchSize) {
+                int count = static_cast<int>(std::min(DistriBatchSize, results[src].size() - first));
+                sendPool->send(results[src].data() + first, count, _TREE_RESULT, src, ResultTAG);
+            }
         }
     }
     return nullptr;
@@ -90,85 +256,680 @@ void *DistriBPlusTree<T>::MPI_background(void *args) {
 
 template <typename T>
 DistriBPlusTree<T>::~DistriBPlusTree() {
+    // Gets nobody waited for still have a reply on the way, so do the chunks of open scans
+    flushLane(client);
+    while (!pending.empty()) progress(true);
+    while (!pendingScans.empty()) receiveChunk(MPI_ANY_SOURCE);
+    // A rank still reading may be sent to a replica that relies on our servers' writes
+    MPI_Barrier(WORLD_);
+
+    // Servers stop shipping writes to replicas, whatever they shipped so far is flushed below
+    {
+        std::lock_guard<BRLock> routeGuard(routeLock);
+        replicas.clear();
+    }
+    // Send what is still buffered, it must reach its owner before our STOP does
+    stopFlusher.store(true, std::memory_order_release);
+    pthread_join(flush_thread, NULL);
+    flushLane(server);
+    flushLane(client);
+    for (MPI_Request &request : resultRequests) {
+        if (request == MPI_REQUEST_NULL) continue;
+        MPI_Cancel(&request);
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+    }
+
     // Tell other MPI processes "I'm going to stop"
     Tree_Request stop_request;
     DBG_PRINT(std::cout << "Subtree rank "<< RANK_ << " scheduled to stop." << std::endl;);
     stop_request.op = RequestType::STOP;
     stop_request.src_rank = RANK_;
 
+    // Every channel of every rank counts its own STOPs
     for (size_t idx = 0; idx < NUM_PROC_; idx++) {
-        MPI_Isend(&stop_request, 1, TREE_REQUEST, idx, RequestTAG, WORLD_, &garbage_request);
+        for (int channel = 0; channel < NUM_SERVER_; channel ++) {
+            client.pool.send(&stop_request, 1, TREE_REQUEST, idx, ChannelTAG + channel);
+        }
     }
-    // foreground should rec numProc ACK from others
+    // foreground should rec numProc * numServers ACK from others
     for (size_t idx = 0; idx < NUM_PROC_; idx ++) {
-        Tree_Request ack_request;
-        MPI_Recv(&ack_request, 1, TREE_REQUEST, idx, AckTAG, WORLD_, MPI_STATUS_IGNORE);
+        for (int channel = 0; channel < NUM_SERVER_; channel ++) {
+            Tree_Request ack_request;
+            MPI_Recv(&ack_request, 1, TREE_REQUEST, idx, AckTAG, WORLD_, MPI_STATUS_IGNORE);
+        }
     }
 
     /**
      * After getting all N ACK from other processes, bg will terminate.
      * */
-    if (pthread_join(bg_thread, NULL) != 0) {
-        std::cerr << "Error joining bg_thread at rank " << RANK_ << std::endl;
-        exit(1);
+    for (pthread_t &bg_thread : bg_threads) {
+        if (pthread_join(bg_thread, NULL) != 0) {
+            std::cerr << "Error joining bg_thread at rank " << RANK_ << std::endl;
+            exit(1);
+        }
     }
     
-    delete bg_args;
+    client.pool.drain();
+    server.pool.drain();
+}
+
+template <typename T>
+int DistriBPlusTree<T>::ownerOf(T key) const {
+    return std::distance(bounds.begin(), std::upper_bound(bounds.begin(), bounds.end(), key));
+}
+
+template <typename T>
+int DistriBPlusTree<T>::channelOf(T key) const {
+    if (replicaOf(key) >= 0) return 0;
+    return static_cast<int>(std::hash<T>{}(key) % NUM_SERVER_);
+}
+
+/**
+ * NOTE: A GET keeps its src_rank and ticket, so the new owner replies to the requester directly.
+ * */
+template <typename T>
+void DistriBPlusTree<T>::forward(Tree_Request request) {
+    request.version = routeVersion.load(std::memory_order_acquire);
+    server.pool.send(&request, 1, TREE_REQUEST, ownerOf(request.key), ChannelTAG + channelOf(request.key));
+}
+
+template <typename T>
+bool DistriBPlusTree<T>::rebalance() {
+    // Everything routed with the current table leaves before the table changes
+    flushLane(server);
+    flushLane(client);
+    // and every write is applied where it was counted, so none is forwarded past a NodeMirror count
+    std::vector<uint64_t> expected(NUM_PROC_);
+    MPI_Alltoall(writesSent.data(), 1, MPI_UINT64_T, expected.data(), 1, MPI_UINT64_T, WORLD_);
+    for (int src = 0; src < NUM_PROC_; src ++) {
+        while (!mirror.caughtUp(src, expected[src])) sched_yield();
+    }
+
+    uint64_t served = servedOps.exchange(0, std::memory_order_relaxed);
+    std::vector<uint64_t> load(NUM_PROC_);
+    MPI_Allgather(&served, 1, MPI_UINT64_T, load.data(), 1, MPI_UINT64_T, WORLD_);
+    if (NUM_PROC_ < 2) return false;
+
+    // Every rank reaches the same decision from the same counts
+    uint64_t total = std::accumulate(load.begin(), load.end(), uint64_t(0));
+    int hot = static_cast<int>(std::max_element(load.begin(), load.end()) - load.begin());
+    if (total == 0 || load[hot] * NUM_PROC_ <= DistriRebalanceFactor * total) return false;
+    int to = hot == 0 ? 1 : hot == NUM_PROC_ - 1 ? hot - 1 : (load[hot - 1] <= load[hot + 1] ? hot - 1 : hot + 1);
+    size_t boundIdx = std::min(hot, to);
+
+    // Only the hot rank knows its keys, it splits them in half and streams the half next to `to`
+    int valid = 0;
+    T splitKey{};
+    std::vector<T> moving;
+    if (RANK_ == hot) {
+        std::lock_guard<BRLock> routeGuard(routeLock);
+        std::vector<T> keys = internalTree.toVec();
+        if (keys.size() >= 2) {
+            valid    = 1;
+            splitKey = keys[keys.size() / 2];
+            // Duplicates of splitKey all stay on the side owning splitKey
+            auto cut = std::lower_bound(keys.begin(), keys.end(), splitKey);
+            if (to > hot) moving.assign(cut, keys.end());
+            else          moving.assign(keys.begin(), cut);
+            internalTree.eraseSorted(moving);
+            dropReplicas();
+            bounds[boundIdx] = splitKey;
+            routeVersion.fetch_add(1, std::memory_order_release);
+        }
+    }
+    MPI_Bcast(&valid, 1, MPI_INT, hot, WORLD_);
+    if (!valid) return false;
+    MPI_Bcast(&splitKey, sizeof(T), MPI_BYTE, hot, WORLD_);
+
+    if (RANK_ == hot) {
+        MPI_Send(moving.data(), static_cast<int>(moving.size() * sizeof(T)), MPI_BYTE, to, MigrateTAG, WORLD_);
+    } else {
+        // `to` serves nothing until the keys are in, requests with the new version wait for it
+        std::lock_guard<BRLock> routeGuard(routeLock);
+        if (RANK_ == to) {
+            MPI_Status status;
+            int bytes;
+            MPI_Probe(hot, MigrateTAG, WORLD_, &status);
+            MPI_Get_count(&status, MPI_BYTE, &bytes);
+            std::vector<T> keys(bytes / sizeof(T));
+            MPI_Recv(keys.data(), bytes, MPI_BYTE, hot, MigrateTAG, WORLD_, MPI_STATUS_IGNORE);
+            internalTree.insertSorted(keys);
+        }
+        dropReplicas();
+        bounds[boundIdx] = splitKey;
+        routeVersion.fetch_add(1, std::memory_order_release);
+    }
+    // Collective, no lookup runs while every rank is in here
+    {
+        std::lock_guard<BRLock> routeGuard(routeLock);
+        mirror.rebuild(internalTree.toVec());
+    }
+    rebalances ++;
+    return true;
+}
+
+template <typename T>
+uint32_t DistriBPlusTree<T>::routingVersion() const {
+    return routeVersion.load(std::memory_order_acquire);
+}
+
+template <typename T>
+uint64_t DistriBPlusTree<T>::numRebalances() const {
+    return rebalances;
+}
+
+template <typename T>
+bool DistriBPlusTree<T>::replicate(T low, T high, int copies, ReadConsistency mode) {
+    // Writes already routed to the range leave before it moves to channel 0
+    flushLane(server);
+    flushLane(client);
+
+    // Every rank computes the same range from the same table
+    ReplicaRange range;
+    range.owner = ownerOf(low);
+    range.low   = low;
+    range.high  = range.owner < NUM_PROC_ - 1 ? std::min(high, bounds[range.owner]) : high;
+    range.mode  = mode;
+    for (int idx = 1; idx < std::min(copies, NUM_PROC_); idx ++) {
+        range.ranks.push_back((range.owner + idx) % NUM_PROC_);
+    }
+    if (range.ranks.empty() || !(range.low < range.high)) return false;
+    for (const ReplicaRange &other : replicas) {
+        if (other.low < range.high && range.low < other.high) return false;
+    }
+
+    // The owner snapshots the range and installs it in one critical section, so every write
+    // is either in the snapshot or shipped afterwards
+    std::lock_guard<BRLock> routeGuard(routeLock);
+    if (RANK_ == range.owner) {
+        std::vector<T> keys = internalTree.toVec();
+        std::vector<T> copy(std::lower_bound(keys.begin(), keys.end(), range.low),
+                            std::lower_bound(keys.begin(), keys.end(), range.high));
+        for (int rank : range.ranks) {
+            MPI_Send(copy.data(), static_cast<int>(copy.size() * sizeof(T)), MPI_BYTE, rank, ReplicaTAG, WORLD_);
+        }
+    } else if (std::find(range.ranks.begin(), range.ranks.end(), RANK_) != range.ranks.end()) {
+        MPI_Status status;
+        int bytes;
+        MPI_Probe(range.owner, ReplicaTAG, WORLD_, &status);
+        MPI_Get_count(&status, MPI_BYTE, &bytes);
+        std::vector<T> keys(bytes / sizeof(T));
+        MPI_Recv(keys.data(), bytes, MPI_BYTE, range.owner, ReplicaTAG, WORLD_, MPI_STATUS_IGNORE);
+        replicaTree.insertSorted(keys);
+    }
+    replicas.push_back(std::move(range));
+    // Writes shipped with the new version wait on a replica until its snapshot is in
+    routeVersion.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * NOTE: Regular sampling, every rank contributes NUM_PROC_ evenly spaced keys of its sorted slice
+ * and the splitters are evenly spaced in all samples, so no rank ends up with more than about
+ * twice its share. Keys and samples travel as bytes.
+ * */
+template <typename T>
+void DistriBPlusTree<T>::bulkLoad(std::vector<T> keys) {
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<T> samples;
+    for (int idx = 0; idx < NUM_PROC_ && !keys.empty(); idx ++) {
+        samples.push_back(keys[keys.size() * idx / NUM_PROC_]);
+    }
+    int sampleBytes = static_cast<int>(samples.size() * sizeof(T));
+    std::vector<int> gatherBytes(NUM_PROC_), gatherDispls(NUM_PROC_);
+    MPI_Allgather(&sampleBytes, 1, MPI_INT, gatherBytes.data(), 1, MPI_INT, WORLD_);
+    std::exclusive_scan(gatherBytes.begin(), gatherBytes.end(), gatherDispls.begin(), 0);
+    std::vector<T> allSamples((gatherDispls.back() + gatherBytes.back()) / sizeof(T));
+    MPI_Allgatherv(samples.data(), sampleBytes, MPI_BYTE, allSamples.data(), gatherBytes.data(), gatherDispls.data(),
+                   MPI_BYTE, WORLD_);
+    if (allSamples.empty()) return;     // Nothing to load on any rank
+
+    std::sort(allSamples.begin(), allSamples.end());
+    std::vector<T> splitters;
+    for (int idx = 1; idx < NUM_PROC_; idx ++) splitters.push_back(allSamples[allSamples.size() * idx / NUM_PROC_]);
+
+    // Rank i gets [splitters[i - 1], splitters[i]), the ranges ownerOf routes by
+    std::vector<int> sendBytes(NUM_PROC_), sendDispls(NUM_PROC_), recvBytes(NUM_PROC_), recvDispls(NUM_PROC_);
+    size_t first = 0;
+    for (int dest = 0; dest < NUM_PROC_; dest ++) {
+        size_t last = dest + 1 < NUM_PROC_ ? std::lower_bound(keys.begin(), keys.end(), splitters[dest]) - keys.begin()
+                                           : keys.size();
+        sendDispls[dest] = static_cast<int>(first * sizeof(T));
+        sendBytes[dest]  = static_cast<int>((last - first) * sizeof(T));
+        first = last;
+    }
+    MPI_Alltoall(sendBytes.data(), 1, MPI_INT, recvBytes.data(), 1, MPI_INT, WORLD_);
+    std::exclusive_scan(recvBytes.begin(), recvBytes.end(), recvDispls.begin(), 0);
+    std::vector<T> local((recvDispls.back() + recvBytes.back()) / sizeof(T));
+    MPI_Alltoallv(keys.data(), sendBytes.data(), sendDispls.data(), MPI_BYTE,
+                  local.data(), recvBytes.data(), recvDispls.data(), MPI_BYTE, WORLD_);
+
+    // Every slice arrives as a sorted run
+    for (int src = 1; src < NUM_PROC_; src ++) {
+        std::inplace_merge(local.begin(), local.begin() + recvDispls[src] / sizeof(T),
+                           local.begin() + (recvDispls[src] + recvBytes[src]) / sizeof(T));
+    }
+
+    std::lock_guard<BRLock> routeGuard(routeLock);
+    dropReplicas();
+    bounds = std::move(splitters);
+    internalTree.buildSorted(local);
+    mirror.rebuild(local);
+    routeVersion.fetch_add(1, std::memory_order_release);
+}
+
+template <typename T>
+size_t DistriBPlusTree<T>::numReplicas() const {
+    return replicas.size();
+}
+
+template <typename T>
+int DistriBPlusTree<T>::replicaOf(T key) const {
+    for (size_t idx = 0; idx < replicas.size(); idx ++) {
+        if (!(key < replicas[idx].low) && key < replicas[idx].high) return static_cast<int>(idx);
+    }
+    return -1;
 }
 
 /**
- * NOTE: We allow multiple keys in a single tree, so insert does not need
- * any cross-process communication. Just insert into the tree directly.
+ * NOTE: Stamps of one src reach a replica in order (channel 0), so the last one applied tells
+ * whether a read from src already observes its own writes.
+ * */
+template <typename T>
+bool DistriBPlusTree<T>::replicaFresh(T key, int src, uint32_t stamp) const {
+    int idx = replicaOf(key);
+    if (idx < 0) return false;
+    const ReplicaRange &range = replicas[idx];
+    if (std::find(range.ranks.begin(), range.ranks.end(), RANK_) == range.ranks.end()) return false;
+    return applied[range.owner * NUM_PROC_ + src].load(std::memory_order_acquire) >= stamp;
+}
+
+template <typename T>
+void DistriBPlusTree<T>::stampWrite(Tree_Request &request) {
+    int idx = replicaOf(request.key);
+    if (idx < 0) return;
+    request.stamp = ++ writeStamps[replicas[idx].owner];
+    replicas[idx].lastWrite = request.stamp;
+}
+
+/**
+ * NOTE: A read a replica was too stale for reaches the owner on another path than the reader's
+ * write, so it may arrive first.
+ * */
+template <typename T>
+bool DistriBPlusTree<T>::ownerObserves(const Tree_Request &request) const {
+    if (request.stamp == 0 || replicaOf(request.key) < 0) return true;
+    return applied[RANK_ * NUM_PROC_ + request.src_rank].load(std::memory_order_acquire) >= request.stamp;
+}
+
+template <typename T>
+void DistriBPlusTree<T>::propagate(Tree_Request request, Lane &lane) {
+    if (request.stamp != 0) applied[RANK_ * NUM_PROC_ + request.src_rank].store(request.stamp, std::memory_order_release);
+    int idx = replicaOf(request.key);
+    if (idx < 0) return;
+    request.op      = request.op == RequestType::INSERT ? RequestType::REPLICA_INSERT : RequestType::REPLICA_REMOVE;
+    request.version = routeVersion.load(std::memory_order_acquire);
+    for (int rank : replicas[idx].ranks) enqueue(lane, rank, request, false);
+}
+
+template <typename T>
+void DistriBPlusTree<T>::applyReplica(const Tree_Request &request, int owner) {
+    // Shipped before the range was dropped
+    int idx = replicaOf(request.key);
+    if (idx < 0 || replicas[idx].owner != owner) return;
+    if (request.op == RequestType::REPLICA_INSERT) replicaTree.insert(request.key);
+    else                                           replicaTree.remove(request.key);
+    // Writes routed before the range was replicated carry no stamp
+    if (request.stamp != 0) applied[owner * NUM_PROC_ + request.src_rank].store(request.stamp, std::memory_order_release);
+}
+
+template <typename T>
+void DistriBPlusTree<T>::dropReplicas() {
+    replicas.clear();
+    replicaTree.eraseSorted(replicaTree.toVec());
+}
+
+/**
+ * NOTE: Writes to a remote key are fire-and-forget and wait in an outbox of the owner. A later
+ * get of the same key is appended to the same outbox (same channel) and flushes it, and MPI does
+ * not let messages with the same source, destination and tag overtake each other, so it still
+ * observes them.
  * */
 template <typename T>
 void DistriBPlusTree<T>::insert(T key) {
-    internalTree.insert(key);
+    Tree_Request insert_request;
+    insert_request.op = RequestType::INSERT;
+    insert_request.src_rank = RANK_;
+    insert_request.key = key;
+    insert_request.version = routeVersion.load(std::memory_order_relaxed);
+    stampWrite(insert_request);
+
+    int owner = ownerOf(key);
+    if (owner == RANK_) {
+        servedOps.fetch_add(1, std::memory_order_relaxed);
+        internalTree.insert(key);
+        mirror.insert(key);
+        propagate(insert_request, client);
+        return;
+    }
+    writesSent[owner] ++;
+    enqueue(client, owner, insert_request, false);
 }
 
 template <typename T>
 void DistriBPlusTree<T>::remove(T key) {
-    // Send request to other process: Blocking!
     Tree_Request remove_request;
     remove_request.op = RequestType::REMOVE;
     remove_request.src_rank = RANK_;
     remove_request.key = key;
-    for (size_t idx = 0; idx < NUM_PROC_; idx++) {
-        if (idx == RANK_) continue;
-        MPI_Isend(&remove_request, 1, TREE_REQUEST, idx, RequestTAG, WORLD_, &garbage_request);
+    remove_request.version = routeVersion.load(std::memory_order_relaxed);
+    stampWrite(remove_request);
+
+    int owner = ownerOf(key);
+    if (owner == RANK_) {
+        servedOps.fetch_add(1, std::memory_order_relaxed);
+        if (internalTree.remove(key)) mirror.remove(key);
+        propagate(remove_request, client);
+        return;
     }
-    /** 
-     * Remove does not get other process's response, because it trusts others to do their jobs correctly.
-     * */
-    internalTree.remove(key);
+    writesSent[owner] ++;
+    enqueue(client, owner, remove_request, false);
 }
 
+/**
+ * NOTE: One round trip to the owner, independent of the number of ranks.
+ * */
 template <typename T>
 std::optional<T> DistriBPlusTree<T>::get(T key) {
-    // Send request to other process: Blocking!
+    return get_async(key).wait();
+}
+
+template <typename T>
+typename DistriBPlusTree<T>::GetHandle DistriBPlusTree<T>::get_async(T key) {
+    int owner = ownerOf(key), target = owner;
+    auto state = std::make_shared<PendingGet>();
     Tree_Request get_request;
     get_request.op = RequestType::GET;
     get_request.src_rank = RANK_;
     get_request.key = key;
-    
-    for (size_t idx = 0; idx < NUM_PROC_; idx++) {
-        if (idx == RANK_) continue;
-        MPI_Isend(&get_request, 1, TREE_REQUEST, idx, RequestTAG, WORLD_, &garbage_request);
+    get_request.version = routeVersion.load(std::memory_order_relaxed);
+
+    // A replicated range is read from our own copy if it is fresh enough, else round robin
+    int idx = replicaOf(key);
+    if (idx >= 0 && owner != RANK_) {
+        ReplicaRange &range = replicas[idx];
+        if (range.mode == ReadConsistency::ReadYourWrites) get_request.stamp = range.lastWrite;
+        if (replicaFresh(key, RANK_, get_request.stamp)) {
+            target = RANK_;
+        } else {
+            size_t pick = range.cursor ++ % (range.ranks.size() + 1);
+            if (pick > 0) target = range.ranks[pick - 1];
+            if (target == RANK_) target = owner;
+        }
     }
 
-    std::optional<T> local_result = internalTree.get(key);
+    if (target == RANK_) {
+        servedOps.fetch_add(1, std::memory_order_relaxed);
+        state->done   = true;
+        state->result = owner == RANK_ ? internalTree.get(key) : replicaTree.get(key);
+        state->completedNs = nowNs();
+        return GetHandle(this, -1, std::move(state));
+    }
 
-    // Recv response from other process
-    for (size_t idx = 0; idx < NUM_PROC_; idx++) {
-        if (idx == RANK_) continue;
-        Tree_Result get_result;
-        MPI_Recv(&get_result, 1, TREE_RESULT, idx, ResultTAG, WORLD_, MPI_STATUS_IGNORE);
-        if (local_result.has_value()) continue;
-        
-        std::optional<T> other_result = get_result.result;
-        if (other_result.has_value()) local_result = other_result;
+    // An owner on this node is read in place once it applied all our writes
+    typename NodeMirror<T>::Probe probe = mirror.lookup(owner, key, writesSent[owner]);
+    if (probe != NodeMirror<T>::Probe::Unavailable) {
+        mirrorHits ++;
+        state->done = true;
+        if (probe == NodeMirror<T>::Probe::Hit) state->result = key;
+        state->completedNs = nowNs();
+        return GetHandle(this, -1, std::move(state));
+    }
+
+    get_request.ticket = nextTicket ++;
+    pending.emplace(get_request.ticket, state);
+    int box = enqueue(client, target, get_request, false);
+    return GetHandle(this, box, std::move(state));
+}
+
+/**
+ * NOTE: Partitions are disjoint, but the streams are still merged by key so that a stream from
+ * any rank may start anywhere in the range.
+ * */
+template <typename T>
+typename DistriBPlusTree<T>::ScanCursor DistriBPlusTree<T>::scan(T low, T high) {
+    auto state = std::make_shared<ScanState>();
+    state->high = high;
+    if (low < high) {
+        for (int rank = ownerOf(low), last = ownerOf(high); rank <= last && rank < NUM_PROC_; rank ++) {
+            // high is exclusive, its owner has no key of the range if its partition starts at high
+            if (rank > 0 && rank == last && !(bounds[rank - 1] < high)) break;
+            ScanStream stream;
+            stream.rank   = rank;
+            stream.resume = low;
+            state->streams.push_back(std::move(stream));
+        }
     }
+    for (size_t idx = 0; idx < state->streams.size(); idx ++) {
+        requestChunk(state, idx);
+        state->empty.push_back(idx);
+    }
+    return ScanCursor(this, std::move(state));
+}
 
-    return local_result;
+template <typename T>
+std::optional<T> DistriBPlusTree<T>::ScanCursor::next() {
+    // Merging needs the head of every stream that is not done
+    auto later = [](const std::pair<T, size_t> &lhs, const std::pair<T, size_t> &rhs) {return rhs.first < lhs.first;};
+    for (size_t idx : state->empty) {
+        ScanStream &stream = state->streams[idx];
+        if (stream.keys.empty() && !stream.done && !stream.inFlight) tree->requestChunk(state, idx);
+        while (stream.keys.empty() && !stream.done) tree->receiveChunk(stream.rank);
+        if (stream.keys.empty()) continue;
+        state->heap.emplace_back(stream.keys.front(), idx);
+        std::push_heap(state->heap.begin(), state->heap.end(), later);
+    }
+    state->empty.clear();
+    if (state->heap.empty()) return std::nullopt;
+
+    std::pop_heap(state->heap.begin(), state->heap.end(), later);
+    auto [key, idx] = state->heap.back();
+    state->heap.pop_back();
+    ScanStream &stream = state->streams[idx];
+    stream.keys.pop_front();
+    if (!stream.keys.empty()) {
+        state->heap.emplace_back(stream.keys.front(), idx);
+        std::push_heap(state->heap.begin(), state->heap.end(), later);
+    } else if (!stream.done) {
+        state->empty.push_back(idx);
+    }
+    return key;
+}
+
+/** A local stream is served in place, a remote one gets its chunk request sent at once. */
+template <typename T>
+void DistriBPlusTree<T>::requestChunk(const std::shared_ptr<ScanState> &state, size_t idx) {
+    ScanStream &stream = state->streams[idx];
+    if (stream.rank == RANK_) {
+        std::vector<T> keys;
+        bool more;
+        {
+            std::shared_lock<BRLock> routeGuard(routeLock);
+            more = scanChunk(stream.resume, stream.skip, state->high, keys);
+        }
+        appendChunk(stream, keys.data(), keys.size(), more);
+        return;
+    }
+
+    Tree_Request scan_request;
+    scan_request.src_rank = RANK_;
+    scan_request.key      = stream.resume;
+    scan_request.high     = state->high;
+    scan_request.version  = routeVersion.load(std::memory_order_relaxed);
+    scan_request.ticket   = nextTicket ++;
+    scan_request.op       = stream.started ? RequestType::SCAN_MORE : RequestType::SCAN;
+    scan_request.stamp    = stream.started ? stream.skip : static_cast<uint32_t>(writesSent[stream.rank]);
+    pendingScans.emplace(scan_request.ticket, std::make_pair(state, idx));
+    // Every write the stamp counts leaves before the scan
+    if (!stream.started) {
+        for (int channel = 0; channel < NUM_SERVER_; channel ++) {
+            int box = stream.rank * NUM_SERVER_ + channel;
+            std::lock_guard<std::mutex> guard(client.outboxes[box]->lock);
+            flush(client, box);
+        }
+    }
+    stream.started  = true;
+    stream.inFlight = true;
+    enqueue(client, stream.rank, scan_request, true);
+}
+
+template <typename T>
+void DistriBPlusTree<T>::receiveChunk(int src) {
+    MPI_Message message;
+    MPI_Status status;
+    int bytes;
+    MPI_Mprobe(src, ScanTAG, WORLD_, &message, &status);
+    MPI_Get_count(&status, MPI_BYTE, &bytes);
+    std::vector<char> buffer(bytes);
+    MPI_Mrecv(buffer.data(), bytes, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+
+    Scan_Chunk chunk;
+    std::memcpy(&chunk, buffer.data(), sizeof(Scan_Chunk));
+    std::vector<T> keys((bytes - sizeof(Scan_Chunk)) / sizeof(T));
+    std::memcpy(keys.data(), buffer.data() + sizeof(Scan_Chunk), keys.size() * sizeof(T));
+
+    auto it = pendingScans.find(chunk.ticket);
+    assert(it != pendingScans.end());
+    auto [state, idx] = it->second;
+    pendingScans.erase(it);
+    ScanStream &stream = state->streams[idx];
+    stream.inFlight = false;
+    appendChunk(stream, keys.data(), keys.size(), chunk.more != 0);
+    // Ask for the next chunk while this one gets merged, the cursor gone means nobody wants it
+    if (!stream.done && state.use_count() > 1) requestChunk(state, idx);
+}
+
+template <typename T>
+void DistriBPlusTree<T>::appendChunk(ScanStream &stream, const T *keys, size_t count, bool more) {
+    stream.done = !more;
+    if (count == 0) return;
+    // Resume after the copies of the last key this stream has delivered
+    size_t copies = 0;
+    while (copies < count && keys[count - 1 - copies] == keys[count - 1]) copies ++;
+    stream.skip   = copies == count && stream.resume == keys[0] ? stream.skip + copies : copies;
+    stream.resume = keys[count - 1];
+    stream.keys.insert(stream.keys.end(), keys, keys + count);
+}
+
+template <typename T>
+bool DistriBPlusTree<T>::scanObserves(const Tree_Request &request) const {
+    if (request.op != RequestType::SCAN) return true;
+    // Wrap-around safe, a scanner never has 2^31 writes in flight
+    uint32_t applied = static_cast<uint32_t>(mirror.appliedFrom(request.src_rank));
+    return static_cast<int32_t>(applied - request.stamp) >= 0;
+}
+
+template <typename T>
+void DistriBPlusTree<T>::serveScan(const Tree_Request &request) {
+    uint32_t skip = request.op == RequestType::SCAN_MORE ? request.stamp : 0;
+    std::vector<T> keys;
+    Scan_Chunk chunk;
+    chunk.ticket = request.ticket;
+    chunk.more   = scanChunk(request.key, skip, request.high, keys);
+    std::vector<char> buffer(sizeof(Scan_Chunk) + keys.size() * sizeof(T));
+    std::memcpy(buffer.data(), &chunk, sizeof(Scan_Chunk));
+    std::memcpy(buffer.data() + sizeof(Scan_Chunk), keys.data(), keys.size() * sizeof(T));
+    server.pool.send(buffer.data(), static_cast<int>(buffer.size()), MPI_BYTE, request.src_rank, ScanTAG);
+}
+
+/**
+ * NOTE: The cursor latches one leaf at a time, a chunk is exact while writers are quiescent and
+ * otherwise sees every leaf atomically.
+ * */
+template <typename T>
+bool DistriBPlusTree<T>::scanChunk(T resume, uint32_t skip, T high, std::vector<T> &out) {
+    auto it = internalTree.lowerBound(resume), last = internalTree.end();
+    for (; it != last && skip > 0 && *it == resume; ++it) skip --;
+    for (; it != last && *it < high && out.size() < DistriScanChunk; ++it) out.push_back(*it);
+    return it != last && *it < high;
+}
+template <typename T>
+void DistriBPlusTree<T>::postResultRecv(int src) {
+    MPI_Irecv(resultBuffers[src].data(), static_cast<int>(DistriBatchSize), TREE_RESULT, src, ResultTAG, WORLD_,
+              &resultRequests[src]);
+}
+
+/**
+ * NOTE: A server splits the results for one requester into replies of at most DistriBatchSize,
+ * whether they answer a batch, GETs it held back (see ownerObserves) or GETs forwarded to it.
+ * Each completed receive is dispatched by ticket and reposted.
+ * */
+template <typename T>
+size_t DistriBPlusTree<T>::progress(bool block) {
+    int outcount;
+    std::vector<int> indices(NUM_PROC_);
+    std::vector<MPI_Status> statuses(NUM_PROC_);
+    if (block) MPI_Waitsome(NUM_PROC_, resultRequests.data(), &outcount, indices.data(), statuses.data());
+    else       MPI_Testsome(NUM_PROC_, resultRequests.data(), &outcount, indices.data(), statuses.data());
+    if (outcount == MPI_UNDEFINED) return 0;    // No peer to hear from
+
+    size_t resolved = 0;
+    uint64_t arrived = nowNs();
+    for (int idx = 0; idx < outcount; idx ++) {
+        int src = indices[idx], count;
+        MPI_Get_count(&statuses[idx], TREE_RESULT, &count);
+        for (int r = 0; r < count; r ++) {
+            const Tree_Result &result = resultBuffers[src][r];
+            auto it = pending.find(result.ticket);
+            assert(it != pending.end());
+            it->second->result = result.result;
+            it->second->done   = true;
+            it->second->completedNs = arrived;
+            pending.erase(it);
+            resolved ++;
+        }
+        postResultRecv(src);
+    }
+    return resolved;
+}
+
+template <typename T>
+bool DistriBPlusTree<T>::GetHandle::ready() {
+    if (!state->done) tree->progress(false);
+    return state->done;
+}
+
+template <typename T>
+std::optional<T> DistriBPlusTree<T>::GetHandle::wait() {
+    if (!state->done) {
+        {
+            std::lock_guard<std::mutex> guard(tree->client.outboxes[box]->lock);
+            tree->flush(tree->client, box);
+        }
+        while (!state->done) tree->progress(true);
+    }
+    return state->result;
+}
+
+/** Space held by this rank only. The replicas and the mirror are copies of keys, charged to copyBytes. */
+template <typename T>
+MemoryStats DistriBPlusTree<T>::memoryStats() {
+    MemoryStats stats = internalTree.memoryStats();
+    stats.otherBytes += sizeof(*this) - sizeof(internalTree) - sizeof(replicaTree) + NUM_SERVER_ * sizeof(Background_Args);
+    stats.copyBytes  += replicaTree.memoryStats().totalBytes();
+    stats.copyBytes  += mirror.bytes();
+    return stats;
+}
+
+template <typename T>
+uint64_t DistriBPlusTree<T>::bytesSent() {
+    return client.pool.bytesSent() + server.pool.bytesSent();
+}
+
+template <typename T>
+uint64_t DistriBPlusTree<T>::numMirrorHits() const {
+    return mirrorHits;
 }
 
 }
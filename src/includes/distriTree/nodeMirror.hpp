@@ -0,0 +1,320 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include "mpi.h"
+#include "distriTree.h"
+
+namespace Tree {
+
+template <typename T>
+NodeMirror<T>::NodeMirror(MPI_Comm world, RemoteRead mode, size_t minSlots): mode(mode), minSlots(minSlots), world(world) {
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm_size(world, &numProc);
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+
+    int nodeSize;
+    MPI_Comm_size(nodeComm, &nodeSize);
+    std::vector<int> worldRanks(numProc);
+    for (int idx = 0; idx < numProc; idx ++) worldRanks[idx] = idx;
+    nodeRankOf.resize(numProc);
+    MPI_Group worldGroup, nodeGroup;
+    MPI_Comm_group(world, &worldGroup);
+    MPI_Comm_group(nodeComm, &nodeGroup);
+    MPI_Group_translate_ranks(worldGroup, numProc, worldRanks.data(), nodeGroup, nodeRankOf.data());
+    MPI_Group_free(&worldGroup);
+    MPI_Group_free(&nodeGroup);
+    for (int &nodeRank : nodeRankOf) if (nodeRank == MPI_UNDEFINED) nodeRank = -1;
+
+    localApplied.reset(new std::atomic<uint64_t>[numProc]());
+    appliedCounts = localApplied.get();
+    // Alone on the node, nobody would read the mirror of a NodeShared rank
+    if (mode == RemoteRead::OneSided || (mode == RemoteRead::NodeShared && nodeSize > 1)) allocate(minSlots);
+}
+
+template <typename T>
+NodeMirror<T>::~NodeMirror() {
+    release();
+    MPI_Comm_free(&nodeComm);
+}
+
+template <typename T>
+void NodeMirror<T>::allocate(size_t slots) {
+    size_t capacity = 1;
+    while (capacity < slots) capacity <<= 1;
+    segmentBytes = sizeof(Header) + numProc * sizeof(std::atomic<uint64_t>) + capacity * sizeof(Slot);
+
+    // Every rank's segment on its own pages, close to the rank writing it
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    char *base;
+    MPI_Win_allocate_shared(static_cast<MPI_Aint>(segmentBytes), 1, info, nodeComm, &base, &win);
+    MPI_Info_free(&info);
+
+    std::memset(base, 0, segmentBytes);
+    header(base)->mask = static_cast<uint32_t>(capacity - 1);
+    for (int src = 0; src < numProc; src ++) {
+        appliedOf(base)[src].store(appliedCounts[src].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    appliedCounts = appliedOf(base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+
+    int nodeSize;
+    MPI_Comm_size(nodeComm, &nodeSize);
+    segments.assign(nodeSize, nullptr);
+    for (int peer = 0; peer < nodeSize; peer ++) {
+        MPI_Aint size;
+        int dispUnit;
+        MPI_Win_shared_query(win, peer, &size, &dispUnit, &segments[peer]);
+    }
+    // No peer reads a segment before its owner initialized it
+    MPI_Win_sync(win);
+    MPI_Barrier(nodeComm);
+
+    if (mode != RemoteRead::OneSided) return;
+    char *own = segments[nodeRankOf[rank]];
+    MPI_Win_create(own, static_cast<MPI_Aint>(segmentBytes), 1, MPI_INFO_NULL, world, &rmaWin);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, rmaWin);
+    masks.resize(numProc);
+    uint32_t mask = header(own)->mask;
+    MPI_Allgather(&mask, 1, MPI_UINT32_T, masks.data(), 1, MPI_UINT32_T, world);
+}
+
+template <typename T>
+void NodeMirror<T>::release() {
+    if (win == MPI_WIN_NULL) return;
+    for (int src = 0; src < numProc; src ++) {
+        localApplied[src].store(appliedCounts[src].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    appliedCounts = localApplied.get();
+    if (rmaWin != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(rmaWin);
+        MPI_Win_free(&rmaWin);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+    segments.clear();
+    segmentBytes = 0;
+}
+
+template <typename T>
+void NodeMirror<T>::rebuild(const std::vector<T> &keys) {
+    if (win == MPI_WIN_NULL) return;
+    std::lock_guard<std::mutex> guard(writeLock);
+    release();
+    allocate(std::max(minSlots, 2 * keys.size()));
+    for (const T &key : keys) {
+        Slot *slot = find(key, true);
+        if (slot == nullptr) break;
+        slot->count.fetch_add(1, std::memory_order_release);
+    }
+    MPI_Barrier(nodeComm);
+}
+
+/**
+ * NOTE: A claim takes over the first slot of the chain whose key the tree no longer holds. Only
+ * if there is none does it take a free slot, rehashing first once the table is 3/4 full.
+ * */
+template <typename T>
+typename NodeMirror<T>::Slot *NodeMirror<T>::find(T key, bool claim) {
+    char *own = segments[nodeRankOf[rank]];
+    Header *head = header(own);
+    Slot *slots = slotsOf(own);
+    Slot *dead = nullptr;
+    for (size_t probe = 0, idx = std::hash<T>{}(key) & head->mask; probe <= head->mask; probe ++, idx = (idx + 1) & head->mask) {
+        Slot &slot = slots[idx];
+        if (slot.used.load(std::memory_order_relaxed) && slot.key == key) return &slot;
+        if (slot.used.load(std::memory_order_relaxed)) {
+            if (dead == nullptr && slot.count.load(std::memory_order_relaxed) == 0) dead = &slot;
+            continue;
+        }
+        if (!claim) return nullptr;
+        if (dead != nullptr) {
+            head->epoch.fetch_add(1, std::memory_order_acq_rel);
+            dead->key = key;
+            head->epoch.fetch_add(1, std::memory_order_release);
+            return dead;
+        }
+        if (4 * (head->used + 1) > 3 * (static_cast<uint64_t>(head->mask) + 1)) {
+            if (!rehash()) {
+                head->disabled.store(1, std::memory_order_release);
+                return nullptr;
+            }
+            return find(key, true);
+        }
+        head->epoch.fetch_add(1, std::memory_order_acq_rel);
+        slot.key = key;
+        slot.used.store(1, std::memory_order_release);
+        head->epoch.fetch_add(1, std::memory_order_release);
+        head->used ++;
+        return &slot;
+    }
+    return nullptr;
+}
+
+/** Drop the slots of removed keys and place the live ones again, false if they would still fill 3/4. */
+template <typename T>
+bool NodeMirror<T>::rehash() {
+    char *own = segments[nodeRankOf[rank]];
+    Header *head = header(own);
+    Slot *slots = slotsOf(own);
+    const size_t capacity = static_cast<size_t>(head->mask) + 1;
+    std::vector<std::pair<T, uint32_t>> live;
+    for (size_t idx = 0; idx < capacity; idx ++) {
+        uint32_t count = slots[idx].count.load(std::memory_order_relaxed);
+        if (slots[idx].used.load(std::memory_order_relaxed) && count > 0) live.emplace_back(slots[idx].key, count);
+    }
+    if (4 * (live.size() + 1) > 3 * capacity) return false;
+
+    head->epoch.fetch_add(1, std::memory_order_acq_rel);
+    for (size_t idx = 0; idx < capacity; idx ++) {
+        slots[idx].used.store(0, std::memory_order_relaxed);
+        slots[idx].count.store(0, std::memory_order_relaxed);
+    }
+    for (const auto &[key, count] : live) {
+        size_t idx = std::hash<T>{}(key) & head->mask;
+        while (slots[idx].used.load(std::memory_order_relaxed)) idx = (idx + 1) & head->mask;
+        slots[idx].key = key;
+        slots[idx].count.store(count, std::memory_order_relaxed);
+        slots[idx].used.store(1, std::memory_order_relaxed);
+    }
+    head->used = live.size();
+    head->epoch.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool NodeMirror<T>::sameNode(int peer) const {
+    return win != MPI_WIN_NULL && nodeRankOf[peer] >= 0;
+}
+
+template <typename T>
+void NodeMirror<T>::insert(T key) {
+    if (win == MPI_WIN_NULL) return;
+    std::lock_guard<std::mutex> guard(writeLock);
+    if (header(segments[nodeRankOf[rank]])->disabled.load(std::memory_order_relaxed)) return;
+    Slot *slot = find(key, true);
+    if (slot != nullptr) slot->count.fetch_add(1, std::memory_order_release);
+}
+
+template <typename T>
+void NodeMirror<T>::remove(T key) {
+    if (win == MPI_WIN_NULL) return;
+    std::lock_guard<std::mutex> guard(writeLock);
+    Slot *slot = find(key, false);
+    if (slot != nullptr && slot->count.load(std::memory_order_relaxed) > 0) slot->count.fetch_sub(1, std::memory_order_release);
+}
+
+/** NOTE: Called once the write is in the tree and the mirror, so a reader counting it sees both. */
+template <typename T>
+void NodeMirror<T>::countApplied(int src) {
+    appliedCounts[src].fetch_add(1, std::memory_order_release);
+}
+
+template <typename T>
+bool NodeMirror<T>::caughtUp(int src, uint64_t expected) const {
+    return appliedFrom(src) >= expected;
+}
+
+template <typename T>
+uint64_t NodeMirror<T>::appliedFrom(int src) const {
+    return appliedCounts[src].load(std::memory_order_acquire);
+}
+
+/**
+ * NOTE: applied is read before disabled. The owner disables the mirror before it counts the write
+ * that did not fit, so a reader that counts all of its writes also sees the mirror disabled.
+ * */
+template <typename T>
+typename NodeMirror<T>::Probe NodeMirror<T>::lookup(int peer, T key, uint64_t writesSent) const {
+    if (mode == RemoteRead::OneSided && win != MPI_WIN_NULL && peer != rank) return remoteLookup(peer, key, writesSent);
+    if (!sameNode(peer)) return Probe::Unavailable;
+    char *segment = segments[nodeRankOf[peer]];
+    if (appliedOf(segment)[rank].load(std::memory_order_acquire) < writesSent) return Probe::Unavailable;
+    Header *head = header(segment);
+    if (head->disabled.load(std::memory_order_acquire)) return Probe::Unavailable;
+
+    for (int tries = 0; tries < DistriMirrorRetries; tries ++) {
+        uint32_t epoch = head->epoch.load(std::memory_order_acquire);
+        if (!(epoch & 1)) {
+            Probe probe = probeSlots(segment, key);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (head->epoch.load(std::memory_order_relaxed) == epoch) return probe;
+        }
+        tornReads ++;
+    }
+    return Probe::Unavailable;
+}
+
+template <typename T>
+typename NodeMirror<T>::Probe NodeMirror<T>::probeSlots(char *segment, T key) const {
+    Header *head = header(segment);
+    Slot *slots = slotsOf(segment);
+    for (size_t probe = 0, idx = std::hash<T>{}(key) & head->mask; probe <= head->mask; probe ++, idx = (idx + 1) & head->mask) {
+        Slot &slot = slots[idx];
+        if (!slot.used.load(std::memory_order_acquire)) return Probe::Miss;
+        if (slot.key == key) return slot.count.load(std::memory_order_acquire) > 0 ? Probe::Hit : Probe::Miss;
+    }
+    return Probe::Miss;
+}
+
+/**
+ * NOTE: Three round trips, the flush between them orders the reads. A torn run is read again,
+ * the applied count is good for every try since it only grows.
+ * */
+template <typename T>
+typename NodeMirror<T>::Probe NodeMirror<T>::remoteLookup(int peer, T key, uint64_t writesSent) const {
+    static_assert(sizeof(SlotImage) == sizeof(Slot) && offsetof(Header, epoch) == sizeof(uint32_t));
+    uint32_t state[2];      // disabled, epoch
+    uint64_t applied;
+    MPI_Get(state, sizeof(state), MPI_BYTE, peer, 0, sizeof(state), MPI_BYTE, rmaWin);
+    MPI_Get(&applied, 1, MPI_UINT64_T, peer, static_cast<MPI_Aint>(sizeof(Header) + rank * sizeof(uint64_t)), 1,
+            MPI_UINT64_T, rmaWin);
+    MPI_Win_flush(peer, rmaWin);
+    if (applied < writesSent || state[0]) return Probe::Unavailable;
+
+    const MPI_Aint slotsAt = static_cast<MPI_Aint>(sizeof(Header) + numProc * sizeof(uint64_t));
+    const size_t capacity = static_cast<size_t>(masks[peer]) + 1;
+    SlotImage run[DistriMirrorRun];
+    size_t idx = std::hash<T>{}(key) & masks[peer], probed = 0;
+    for (int tries = 0; tries < DistriMirrorRetries && probed < capacity; ) {
+        // A run stops at the end of the table, the next one starts over at slot 0
+        size_t count = std::min(DistriMirrorRun, capacity - idx);
+        uint32_t epoch;
+        MPI_Get(run, static_cast<int>(count * sizeof(SlotImage)), MPI_BYTE, peer,
+                slotsAt + static_cast<MPI_Aint>(idx * sizeof(SlotImage)), static_cast<int>(count * sizeof(SlotImage)),
+                MPI_BYTE, rmaWin);
+        MPI_Win_flush(peer, rmaWin);
+        MPI_Get(&epoch, 1, MPI_UINT32_T, peer, static_cast<MPI_Aint>(offsetof(Header, epoch)), 1, MPI_UINT32_T, rmaWin);
+        MPI_Win_flush(peer, rmaWin);
+        if ((state[1] & 1) || epoch != state[1]) {
+            tornReads ++;
+            tries ++;
+            state[1] = epoch;
+            continue;
+        }
+
+        for (size_t slot = 0; slot < count; slot ++) {
+            if (!run[slot].used) return Probe::Miss;
+            if (run[slot].key == key) return run[slot].count > 0 ? Probe::Hit : Probe::Miss;
+        }
+        probed += count;
+        idx = (idx + count) & masks[peer];
+    }
+    return probed < capacity ? Probe::Unavailable : Probe::Miss;
+}
+
+template <typename T>
+uint64_t NodeMirror<T>::numTornReads() const {
+    return tornReads;
+}
+
+template <typename T>
+size_t NodeMirror<T>::bytes() const {
+    return segmentBytes;
+}
+
+}
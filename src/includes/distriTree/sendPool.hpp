@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstring>
+#include <sched.h>
+#include "mpi.h"
+#include "distriTree.h"
+
+namespace Tree {
+
+inline SendPool::SendPool(MPI_Comm world, size_t slots, bool grow):
+world(world), grow(grow), requests(slots, MPI_REQUEST_NULL), buffers(slots), indices(slots) {
+    for (int slot = static_cast<int>(slots) - 1; slot >= 0; slot --) freeSlots.push_back(slot);
+}
+
+inline SendPool::~SendPool() {
+    drain();
+}
+
+inline void SendPool::send(const void *data, int count, MPI_Datatype type, int dest, int tag) {
+    int typeSize;
+    MPI_Type_size(type, &typeSize);
+    size_t bytes = static_cast<size_t>(count) * typeSize;
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (freeSlots.empty()) {
+        // Back-pressure, wait for the receivers to catch up
+        if (retireLocked() != 0) break;
+        if (grow) {
+            // Moving the buffers keeps their data in place for the sends in flight
+            requests.push_back(MPI_REQUEST_NULL);
+            buffers.emplace_back();
+            indices.push_back(0);
+            freeSlots.push_back(static_cast<int>(requests.size()) - 1);
+            break;
+        }
+        guard.unlock();
+        sched_yield();
+        guard.lock();
+    }
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    // Posting under the lock keeps the sends of one thread to one rank in order
+    std::vector<char> &buffer = buffers[slot];
+    buffer.resize(bytes);
+    std::memcpy(buffer.data(), data, bytes);
+    MPI_Isend(buffer.data(), count, type, dest, tag, world, &requests[slot]);
+    totalBytes += bytes;
+    totalMessages ++;
+}
+
+inline size_t SendPool::retire() {
+    std::lock_guard<std::mutex> guard(lock);
+    return retireLocked();
+}
+
+inline size_t SendPool::retireLocked() {
+    if (freeSlots.size() == requests.size()) return 0;
+    int outcount;
+    MPI_Testsome(static_cast<int>(requests.size()), requests.data(), &outcount, indices.data(), MPI_STATUSES_IGNORE);
+    if (outcount == MPI_UNDEFINED) return 0;
+    // MPI_Testsome already reset the completed requests to MPI_REQUEST_NULL
+    for (int idx = 0; idx < outcount; idx ++) freeSlots.push_back(indices[idx]);
+    return outcount;
+}
+
+inline void SendPool::drain() {
+    std::lock_guard<std::mutex> guard(lock);
+    MPI_Waitall(static_cast<int>(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+    freeSlots.clear();
+    for (int slot = static_cast<int>(requests.size()) - 1; slot >= 0; slot --) freeSlots.push_back(slot);
+}
+
+inline size_t SendPool::inFlight() {
+    std::lock_guard<std::mutex> guard(lock);
+    return requests.size() - freeSlots.size();
+}
+
+inline uint64_t SendPool::bytesSent() {
+    std::lock_guard<std::mutex> guard(lock);
+    return totalBytes;
+}
+
+inline uint64_t SendPool::messagesSent() {
+    std::lock_guard<std::mutex> guard(lock);
+    return totalMessages;
+}
+
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include <cmath>
+#include <limits>
+#include <deque>
+#include <set>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -8,69 +11,181 @@
 #include <iostream>
 #include <cassert>
 #include <type_traits>
+#include <utility>
+#include <numeric>
+#include <algorithm>
 #include <unistd.h>
 #include <pthread.h>
 #include <iomanip>
 #include <sys/wait.h>
 #include <cstdio>
+#include <cstddef>
+#include <chrono>
 #include "mpi.h"
 #include "tree.h"
 #include "utility/timing.h"
+#include "utility/Histogram.h"
+#include "utility/TraceFile.h"
 #include "distriTree/distriTree.h"
 
 namespace Engine {
 
+/**
+ * How a trace is split into the per-thread op streams of the threaded engines.
+ *  Modulo     - key % threads, every key stays on one thread
+ *  RoundRobin - the i-th op goes to thread i % threads, even load but keys move between threads
+ *  KeyRange   - the trace's key range cut into equal contiguous slices, one per thread
+ */
+enum class Partition {Modulo, RoundRobin, KeyRange};
+
 struct EngineConfig {
     int order;
     int numProcess;
     int numWorker;
     std::vector<std::string> paths;
     std::optional<std::pair<int, int>> prefill = std::nullopt;
+    std::optional<double> compactLeaves = std::nullopt;     // Pack leaves at least this full (see LeafCodec)
+    bool sortedBatches = false;                             // SeqEngine applies runs of INSERT / REMOVE as sorted batches
+    int getWindow = 1;                                      // DistributeEngine keeps up to this many gets in flight per rank
+    size_t rebalanceEvery = 0;                              // DistributeEngine rebalances ranks every this many entries, 0 = never
+    std::vector<std::pair<int, int>> replicaRanges = {};    // DistributeEngine replicates these [low, high) after the prefill
+    int replicaCopies = 2;                                  // Copies of each replicated range, the owner's included
+    bool replicateCase = false;                             // DistributeEngine also replicates the case's key range, every owner its part
+    Tree::RemoteRead remoteReads = Tree::RemoteRead::NodeShared;    // How DistributeEngine gets reach remote owners
+    Partition partition = Partition::Modulo;                // How ThreadEngine / BenchmarkEngine split the trace between threads
+    bool recordLatency = false;                             // BenchmarkEngine reports per-op latency percentiles
+    bool checkResults = false;                              // DistributeEngine checks every GET against the case (keys split by modulo)
+    bool checkScans = false;                                // and with checkResults, scans the case's key range at every BARRIER
 };
 
+/**
+ * Trees with a compressed leaf format expose compactLeaves(minFill, coldOnly), CompactLeaves is a
+ * no-op for every other tree so the engines can call it unconditionally.
+ */
+template <typename Tree, typename = void>
+struct HasCompactLeaves : std::false_type {};
+
+template <typename Tree>
+struct HasCompactLeaves<Tree, std::void_t<decltype(std::declval<Tree&>().compactLeaves(0.5, true))>> : std::true_type {};
+
+template <typename Tree>
+void CompactLeaves(Tree *tree, std::optional<double> minFill, bool coldOnly) {
+    if constexpr (HasCompactLeaves<Tree>::value) {
+        if (minFill.has_value()) tree->compactLeaves(minFill.value(), coldOnly);
+    }
+}
+
+/**
+ * Range-partitioned trees (ShardedTree) cut their key domain into shards when they are built, so
+ * MakeTree hands them the key range the case will use. Every other tree is built from its order.
+ */
+template <typename TreeType>
+struct IsRangePartitioned : std::false_type {};
+
+template <typename K, template <typename> class Inner>
+struct IsRangePartitioned<Tree::ShardedTree<K, Inner>> : std::true_type {};
+
+template <typename TreeType>
+TreeType MakeTree(int order, std::pair<int, int> keys) {
+    if constexpr (IsRangePartitioned<TreeType>::value) return TreeType(order, Tree::ShardDefaultNum, keys.first, keys.second);
+    else return TreeType(order);
+}
+
+/** The value a GET or REMOVE of the trace expects to find, if any. */
+inline std::optional<int> expect(const TraceRecord &entry) {
+    return entry.hasExpect ? std::optional<int>(entry.expect) : std::nullopt;
+}
+
+inline bool isBarrier(const TraceRecord &entry) {return entry.op == TraceBarrier;}
+
+inline void print(const TraceRecord &entry) {
+    if (entry.op == TraceGet) std::cout << "GET ";
+    else if (entry.op == TraceInsert) std::cout << "INSERT ";
+    else if (entry.op == TraceRemove) std::cout << "DELETE ";
+    else std::cout << "BARRIER ";
+
+    if (entry.hasExpect) {
+        std::cout << "\t" << entry.key << ", expect: " << entry.expect << std::endl;
+    } else {
+        std::cout << "\t" << entry.key << ", expect: NONE" << std::endl;
+    }
+}
+
 template <template <typename> class T>
 class IEngine {
     public:
-        enum TestOp {INSERT, REMOVE, GET, BARRIER};
-
-        struct TestEntry {
-            int value;
-            TestOp op;
-            std::optional<int> expect;
+        /** The ops of a trace under the names the engines switch on. */
+        struct TestOp {
+            static constexpr TraceOp INSERT  = TraceInsert;
+            static constexpr TraceOp REMOVE  = TraceRemove;
+            static constexpr TraceOp GET     = TraceGet;
+            static constexpr TraceOp BARRIER = TraceBarrier;
+        };
 
-            explicit TestEntry(const std::string &line);
-            bool isBarrier() {return op == TestOp::BARRIER;};
-            void print();
+        /** The records of a mapped trace are used in place. */
+        using TestEntry = TraceRecord;
+
+        /**
+         * The entries of the loaded case. A binary trace (.bcase) is mapped and read in place,
+         * a text case is parsed into records once.
+         */
+        class TestCase {
+            public:
+                size_t size() const {return count;}
+                const TestEntry &operator[](size_t idx) const {return entries[idx];}
+                const TestEntry &at(size_t idx) const {assert(idx < count); return entries[idx];}
+                const TestEntry *begin() const {return entries;}
+                const TestEntry *end() const {return entries + count;}
+                bool load(const std::string &filePath);
+
+            private:
+                MappedTrace mapped;
+                std::vector<TraceRecord> parsed;
+                const TestEntry *entries = nullptr;
+                size_t count = 0;
         };
 
         struct WorkerArgs {
             T<int> *concurrent_tree;
             T<int> *seq_tree;
-            std::vector<TestEntry> *currCase;
+            TestCase *currCase;
+            const std::vector<TestEntry> *stream;   // This thread's share of currCase
             int threadID;
             int threadNum;
             Barrier *barrierA;
             Barrier *barrierB;
+            std::optional<double> compactLeaves;
+            OpLatency *latency = nullptr;           // This thread's samples, nullptr if not recorded
         };
     
     public:
         int order{};
         int numProcess{};
+        std::optional<double> compactLeaves;
         std::vector<std::string> paths;
-        std::vector<TestEntry> currCase;
+        TestCase currCase;
+        Partition partition = Partition::Modulo;
+        std::vector<std::vector<TestEntry>> streams;    // currCase split per thread, see partitionCase
     
     public:
         [[maybe_unused]] virtual void Run() = 0;
         void loadTestCase(const std::string &filePath);
+        void partitionCase(int threadNum);
+        std::pair<int, int> keyRange(const std::optional<std::pair<int, int>> &prefill) const;
 };
 
 template <template <typename> class T>
 class SeqEngine : public IEngine<T> {
+    private:
+        bool sortedBatches = false;
+
     public:
         explicit SeqEngine(const EngineConfig &cfg){
             this->paths = cfg.paths;
             this->order = cfg.order;
             this->numProcess = cfg.numProcess;
+            this->compactLeaves = cfg.compactLeaves;
+            this->sortedBatches = cfg.sortedBatches;
         }
 
         void Run() {
@@ -87,25 +202,53 @@ class SeqEngine : public IEngine<T> {
             }
         }
 
+        /**
+         * Apply the run of INSERT (or REMOVE) entries starting at idx as one sorted batch and
+         * return the index of its last entry. For removals only the number of keys removed
+         * can be checked against the expectations.
+         */
+        size_t runSortedBatch(T<int> &tree, size_t idx, bool &pass) {
+            const auto op = this->currCase[idx].op;
+            std::vector<int> keys;
+            size_t expectRemoved = 0, last = idx;
+            for (; last < this->currCase.size() && this->currCase[last].op == op; last ++) {
+                keys.push_back(this->currCase[last].key);
+                if (this->currCase[last].hasExpect) expectRemoved ++;
+            }
+            std::sort(keys.begin(), keys.end());
+            if (op == IEngine<T>::TestOp::INSERT) tree.insertSorted(keys);
+            else pass = tree.eraseSorted(keys) == expectRemoved;
+            return last - 1;
+        }
+
         bool runTestCase(T<int> &tree) {
             for (size_t idx = 0; idx < this->currCase.size(); idx ++) {
                 auto entry = this->currCase[idx];
-                bool hasKey;
+                bool hasKey, pass = true;
                 std::optional<int> key;
+                if (sortedBatches && (entry.op == IEngine<T>::TestOp::INSERT || entry.op == IEngine<T>::TestOp::REMOVE)) {
+                    idx = runSortedBatch(tree, idx, pass);
+                    if (!pass) return false;
+                    continue;
+                }
                 switch (entry.op){
                 case IEngine<T>::TestOp::INSERT:
-                    tree.insert(entry.value);
+                    tree.insert(entry.key);
                     break;
                 
                 case IEngine<T>::TestOp::REMOVE:
-                    hasKey = tree.remove(entry.value);
-                    if (hasKey != entry.expect.has_value()) return false;
+                    hasKey = tree.remove(entry.key);
+                    if (hasKey != expect(entry).has_value()) return false;
                     break;
 
                 case IEngine<T>::TestOp::GET:
-                    key = tree.get(entry.value);
-                    if (key.has_value() != entry.expect.has_value()) return false;
-                    if (key.has_value() && (key.value() != entry.expect.value())) return false;
+                    key = tree.get(entry.key);
+                    if (key.has_value() != expect(entry).has_value()) return false;
+                    if (key.has_value() && (key.value() != expect(entry).value())) return false;
+                    break;
+
+                case IEngine<T>::TestOp::BARRIER:
+                    CompactLeaves(&tree, this->compactLeaves, true);
                     break;
                 default:
                     break;
@@ -130,6 +273,10 @@ class ThreadEngine : public IEngine<T> {
         this->paths = cfg.paths;
         this->order = cfg.order;
         this->numProcess = cfg.numProcess;
+        this->compactLeaves = cfg.compactLeaves;
+        // The check at each BARRIER needs every key's ops applied in trace order
+        assert(cfg.partition != Partition::RoundRobin);
+        this->partition = cfg.partition;
     };
 
     void Run() {
@@ -137,10 +284,11 @@ class ThreadEngine : public IEngine<T> {
             auto testCase = this->paths[i];
             std::cout << "Running " << testCase << " ..." << std::flush;
             IEngine<T>::loadTestCase(testCase);
+            IEngine<T>::partitionCase(this->numProcess);
             {
                 int threadNum = this->numProcess;
-                auto concurrent_tree = T<int>(this->order);
-                auto seq_tree = T<int>(this->order);
+                auto concurrent_tree = MakeTree<T<int>>(this->order, this->keyRange(std::nullopt));
+                auto seq_tree = MakeTree<T<int>>(this->order, this->keyRange(std::nullopt));
                 typename IEngine<T>::WorkerArgs args[threadNum + 2];
                 pthread_t threads[threadNum + 2];
 
@@ -148,10 +296,12 @@ class ThreadEngine : public IEngine<T> {
                     args[threadId].concurrent_tree = &concurrent_tree;
                     args[threadId].seq_tree  = &seq_tree;
                     args[threadId].currCase  = &this->currCase;
+                    args[threadId].stream    = threadId < threadNum ? &this->streams[threadId] : nullptr;
                     args[threadId].threadID  = threadId;
                     args[threadId].threadNum = threadNum;
                     args[threadId].barrierA  = &this->barrierA;
                     args[threadId].barrierB  = &this->barrierB;
+                    args[threadId].compactLeaves = this->compactLeaves;
                 }
 
                 // initialize the barrier with the number of threads
@@ -194,7 +344,6 @@ class ThreadEngine : public IEngine<T> {
         auto warg = static_cast<typename IEngine<T>::WorkerArgs *>(arg);
         
         T<int> *tree;
-        auto currCase = warg->currCase;
         int thread_id = warg->threadID;
         DBG_ASSERT(thread_id < warg->threadNum + 1);
 
@@ -203,29 +352,30 @@ class ThreadEngine : public IEngine<T> {
         if (isConcurrentThread) tree = warg->concurrent_tree;
         else tree = warg->seq_tree;
 
-        for (size_t idx = 0; idx < currCase->size(); idx ++) {
-            auto entry = currCase->at(idx);
+        // Concurrent threads run their own stream, the seq tree thread replays the whole case
+        using TestEntry = typename IEngine<T>::TestEntry;
+        const TestEntry *first = isConcurrentThread ? warg->stream->data() : warg->currCase->begin();
+        const TestEntry *last  = isConcurrentThread ? first + warg->stream->size() : warg->currCase->end();
 
-            if (isConcurrentThread && !entry.isBarrier() && 
-                (entry.value % warg->threadNum != thread_id)
-            ) continue;
+        for (const TestEntry *it = first; it != last; it ++) {
+            const TestEntry &entry = *it;
 
             bool hasKey;
             std::optional<int> key;
 
             switch (entry.op){
             case IEngine<T>::TestOp::INSERT:
-                key = tree->get(entry.value);
+                key = tree->get(entry.key);
                 if (key.has_value()) break;
-                tree->insert(entry.value);
+                tree->insert(entry.key);
                 break;
             
             case IEngine<T>::TestOp::REMOVE:
-                hasKey = tree->remove(entry.value);
+                hasKey = tree->remove(entry.key);
                 break;
 
             case IEngine<T>::TestOp::GET:
-                key = tree->get(entry.value);
+                key = tree->get(entry.key);
                 break;
             
             case IEngine<T>::TestOp::BARRIER:
@@ -249,19 +399,19 @@ class ThreadEngine : public IEngine<T> {
         auto    currCase        = warg->currCase;
         
 
-        for (size_t idx = 0; idx < currCase->size(); idx ++) {
-            auto entry = currCase->at(idx);
-
+        for (const auto &entry : *currCase) {
             bool hasKey;
             std::optional<int> key;
             switch (entry.op){
             case IEngine<T>::TestOp::GET:
-                key = concurrent_tree->get(entry.value);
+                key = concurrent_tree->get(entry.key);
                 break;
             case IEngine<T>::TestOp::BARRIER:
                 warg->barrierA->wait();
                 // pthread_barrier_wait(warg->barrierA);
                 compare(concurrent_tree, seq_tree);
+                // Writers are parked on barrierB, pack the cold leaves while the tree is quiescent
+                CompactLeaves(concurrent_tree, warg->compactLeaves, true);
                 warg->barrierB->wait();
                 // pthread_barrier_wait(warg->barrierB);
                 break;
@@ -276,28 +426,74 @@ class ThreadEngine : public IEngine<T> {
         concurrent_tree->debug_checkIsValid(false);
         seq_tree->debug_checkIsValid(false);
 
-        std::vector<int> concurrent_vec = concurrent_tree->toVec();
-        std::vector<int> seq_vec = seq_tree->toVec();
+        /**
+         * Walk both trees in lockstep instead of copying them with toVec(). The iterators are
+         * scoped so that any latch they hold is released before printing.
+         */
+        bool sameKeys = true, sameSize = true;
+        {
+            auto concurrentIt = concurrent_tree->begin(), concurrentEnd = concurrent_tree->end();
+            auto seqIt        = seq_tree->begin(),        seqEnd        = seq_tree->end();
+            for (; concurrentIt != concurrentEnd && seqIt != seqEnd; ++concurrentIt, ++seqIt) {
+                if (*concurrentIt != *seqIt) {
+                    sameKeys = false;
+                    break;
+                }
+            }
+            if (sameKeys) sameSize = (concurrentIt == concurrentEnd) && (seqIt == seqEnd);
+        }
 
-        if (concurrent_vec.size() != seq_vec.size()) {
-            throw std::runtime_error("concurrent vec size different from seq_vec size");
+        if (!sameSize) {
+            throw std::runtime_error("concurrent tree size different from seq tree size");
         }
-        for (size_t i = 0; i < concurrent_vec.size(); i ++) {
-            if (concurrent_vec[i] != seq_vec[i]) {
-                concurrent_tree->print();
-                seq_tree->print();
-                throw std::runtime_error("concurrent_vec different from seq_vec");
-            }
+        if (!sameKeys) {
+            concurrent_tree->print();
+            seq_tree->print();
+            throw std::runtime_error("concurrent tree different from seq tree");
         }
         return true;
     }
 };
 
+/**
+ * Compile-time order dispatch. Trees declared as template <typename T, int Order> are instantiated
+ * once for every order in DispatchOrders, so their thresholds and key searches are specialized;
+ * Run() picks the instantiation matching cfg.order and falls back to the runtime-order tree
+ * (Order = 0) for any other order.
+ */
+using DispatchOrders = std::integer_sequence<int, 8, 16, 32, 64, 128>;
+
+template <template <typename, int> class Tree, int Order>
+struct OrderBind {
+    template <typename T> using type = Tree<T, Order>;
+};
+
+template <template <template <typename> class> class Runner, template <typename, int> class Tree>
+class OrderDispatch {
+public:
+    static void Run(EngineConfig const &cfg) {
+        Run(cfg, DispatchOrders{});
+    }
+
+private:
+    template <int... Orders>
+    static void Run(EngineConfig const &cfg, std::integer_sequence<int, Orders...>) {
+        bool dispatched = ((cfg.order == Orders && (RunWith<Orders>(cfg), true)) || ...);
+        if (!dispatched) RunWith<0>(cfg);
+    }
+
+    template <int Order>
+    static void RunWith(EngineConfig const &cfg) {
+        auto runner = Runner<OrderBind<Tree, Order>::template type>(cfg);
+        runner.Run();
+    }
+};
+
 template <template <typename> class T>
 class RunnerInitSpecialization {
 public:
-    static T<int>* BuildTree(int order, int numWorker) {
-        auto tree_alloc = new T<int>(order);
+    static T<int>* BuildTree(int order, [[maybe_unused]] int numWorker, std::pair<int, int> keys) {
+        auto tree_alloc = new T<int>(MakeTree<T<int>>(order, keys));
         return tree_alloc;
     }
 };
@@ -309,7 +505,7 @@ public:
 template <>
 class RunnerInitSpecialization<Tree::FreeBPlusTree> {
 public:
-    static Tree::FreeBPlusTree<int> *BuildTree(int order, int numWorker) {
+    static Tree::FreeBPlusTree<int> *BuildTree(int order, int numWorker, [[maybe_unused]] std::pair<int, int> keys) {
         Tree::FreeBPlusTree<int> *tree_alloc = new Tree::FreeBPlusTree<int>(order, numWorker);
         return tree_alloc;
     }
@@ -321,6 +517,7 @@ class BenchmarkEngine : public IEngine<T> {
 public:
     int repeatNum{};
     int numWorker{};
+    bool recordLatency = false;
     std::optional<std::pair<int, int>> prefill;
 
 public:
@@ -331,11 +528,21 @@ public:
         this->repeatNum = 5;
         this->prefill = cfg.prefill;
         this->numWorker = cfg.numWorker;
+        this->compactLeaves = cfg.compactLeaves;
+        this->partition = cfg.partition;
+        this->recordLatency = cfg.recordLatency;
     }
 
     void inline Prefill(T<int> *tree, int start, int end) {
-        for (int elem = start; elem < end; elem ++) {
-            tree->insert(elem);
+        if constexpr (std::is_base_of<Tree::ITree<int>, T<int>>::value) {
+            // The prefill range is already sorted, load it through the batch path
+            std::vector<int> keys(std::max(end - start, 0));
+            std::iota(keys.begin(), keys.end(), start);
+            tree->insertSorted(keys);
+        } else {
+            for (int elem = start; elem < end; elem ++) {
+                tree->insert(elem);
+            }
         }
     }
 
@@ -345,19 +552,45 @@ public:
         for (size_t i = 0; i < this->paths.size(); i ++) {
             auto testCase = this->paths[i];
             IEngine<T>::loadTestCase(testCase);
+            // Split once, outside the timed runs
+            IEngine<T>::partitionCase(threadNum);
 
             double run_seconds = 0.0f, build_seconds = 0.0f, del_seconds = 0.0f;
+            std::optional<Tree::MemoryStats> memory;
+            // Every repeat's samples, per thread for synchronous trees, from the tree for PALM
+            std::unique_ptr<OpLatency> latency;
+            std::vector<OpLatency> threadLatency;
+            if (recordLatency) {
+                latency = std::make_unique<OpLatency>();
+                if constexpr (std::is_base_of<Tree::ITree<int>, T<int>>::value) threadLatency.resize(threadNum);
+            }
+#ifdef LOCK_PROFILE
+            LockProfile::Stats latchProfile;
+#endif
             
+            std::pair<int, int> keys = this->keyRange(prefill);
             for (int repeat = 0; repeat < repeatNum; repeat ++) {
                 Timer caseTimer;
-                T<int> *concurrent_tree = RunnerInitSpecialization<T>::BuildTree(this->order, this->numWorker);
+                T<int> *concurrent_tree = RunnerInitSpecialization<T>::BuildTree(this->order, this->numWorker, keys);
                 build_seconds += caseTimer.elapsed();
+                std::unique_ptr<OpLatency> treeLatency;
 
                 // If have prefill, process the prefills first.
                 if (prefill.has_value()) {
                     int start = prefill->first, end = prefill->second;
                     Prefill(concurrent_tree, start, end);
                 }
+                // Every prefilled leaf was just written, so do not skip the hot ones
+                CompactLeaves(concurrent_tree, this->compactLeaves, false);
+                // Only profile the measured run, not the prefill.
+                LOCK_PROFILE_DO(LockProfile::reset();)
+                if constexpr (!std::is_base_of<Tree::ITree<int>, T<int>>::value) {
+                    // PALM answers asynchronously, the tree times each request until its batch completes
+                    if (recordLatency) {
+                        treeLatency = std::make_unique<OpLatency>();
+                        concurrent_tree->trackLatency(treeLatency.get());
+                    }
+                }
 
                 caseTimer.reset();
 
@@ -367,8 +600,10 @@ public:
                 for (int threadId = 0; threadId < threadNum; threadId ++) {
                     args[threadId].concurrent_tree = concurrent_tree;
                     args[threadId].currCase  = &this->currCase;
+                    args[threadId].stream    = &this->streams[threadId];
                     args[threadId].threadID  = threadId;
                     args[threadId].threadNum = threadNum;
+                    args[threadId].latency   = threadLatency.empty() ? nullptr : &threadLatency[threadId];
                 }
 
                 caseTimer.reset();
@@ -384,11 +619,22 @@ public:
                 }
 
                 run_seconds += caseTimer.elapsed();
+                LOCK_PROFILE_DO(latchProfile.merge(LockProfile::collect());)
+
+                // Space of the tree the last run left behind. PALM trees may still have
+                // requests in flight here, they are only quiescent once deleted.
+                if constexpr (std::is_base_of<Tree::ITree<int>, T<int>>::value) {
+                    if (repeat == repeatNum - 1) memory = concurrent_tree->memoryStats();
+                }
 
                 caseTimer.reset();
                 delete concurrent_tree;
                 del_seconds += caseTimer.elapsed();
+
+                // The PALM tree has completed its last batch once deleted
+                if (treeLatency) latency->merge(*treeLatency);
             }
+            for (OpLatency &samples : threadLatency) latency->merge(samples);
 
             run_seconds = run_seconds / repeatNum;
             build_seconds = build_seconds / repeatNum;
@@ -407,6 +653,9 @@ public:
             toFixedLenStr(run_ms       , 4) << "ms, prep in " <<
             toFixedLenStr(build_ms     , 4) << "ms, del in  " <<
             toFixedLenStr(del_ms       , 4) << std::endl;
+            if (memory.has_value()) memory->print(std::cout);
+            if (latency) printLatency(*latency);
+            LOCK_PROFILE_DO(if (latchProfile.acquisitions() != 0) latchProfile.print(std::cout);)
         }
         std::cout << "Average MQPS:" << toFixedLenStr(average_qps / this->paths.size(), 5) << std::endl;
     }
@@ -424,62 +673,157 @@ private:
         return str;
     }
 
+    /** Percentiles over every repeat of a case, in us. */
+    static void printLatency(const OpLatency &latency) {
+        std::cout << std::fixed << std::setprecision(2)
+                  << "\t  op            count    p50(us)    p90(us)    p99(us)   p999(us)    max(us)" << std::endl;
+        auto printOp = [](const char *name, const LatencyHistogram &hist) {
+            if (hist.count() == 0) return;
+            std::cout << "\t  " << std::left << std::setw(8) << name << std::right
+                      << std::setw(11) << hist.count()
+                      << std::setw(11) << hist.percentile(50)   / 1000.0
+                      << std::setw(11) << hist.percentile(90)   / 1000.0
+                      << std::setw(11) << hist.percentile(99)   / 1000.0
+                      << std::setw(11) << hist.percentile(99.9) / 1000.0
+                      << std::setw(11) << hist.max()            / 1000.0 << std::endl;
+        };
+        printOp("INSERT", latency.insert);
+        printOp("REMOVE", latency.remove);
+        printOp("GET", latency.get);
+        std::cout.unsetf(std::ios_base::floatfield);
+    }
+
     static void *runTestCase(void* arg) {
         auto warg = static_cast<typename IEngine<T>::WorkerArgs *>(arg);
         T<int> *tree = warg->concurrent_tree;
-        auto currCase = warg->currCase;
-        int thread_id = warg->threadID;
-        DBG_ASSERT(thread_id < warg->threadNum + 1);
+        OpLatency *latency = warg->latency;
+        DBG_ASSERT(warg->threadID < warg->threadNum + 1);
 
-        for (size_t idx = 0; idx < currCase->size(); idx ++) {
-            auto entry = currCase->at(idx);
-            if (entry.value % warg->threadNum != thread_id) continue;
+        for (const auto &entry : *warg->stream) {
+            uint64_t start = latency == nullptr ? 0 : nowNs();
             switch (entry.op){
             case IEngine<T>::TestOp::INSERT:
-                tree->insert(entry.value);
+                tree->insert(entry.key);
                 break;
             case IEngine<T>::TestOp::REMOVE:
-                tree->remove(entry.value);
+                tree->remove(entry.key);
                 break;
             case IEngine<T>::TestOp::GET:
-                tree->get(entry.value);
+                tree->get(entry.key);
                 break;
             case IEngine<T>::TestOp::BARRIER:
                 break;
             }
+            if (latency == nullptr) continue;
+            if (entry.op == IEngine<T>::TestOp::INSERT)      latency->insert.record(nowNs() - start);
+            else if (entry.op == IEngine<T>::TestOp::REMOVE) latency->remove.record(nowNs() - start);
+            else if (entry.op == IEngine<T>::TestOp::GET)    latency->get.record(nowNs() - start);
         }
         return nullptr;
     }
 };
 
+/** Smallest and largest key of the prefill and the loaded case. */
 template <template <typename> class T>
-IEngine<T>::TestEntry::TestEntry(const std::string &line) {
-    if (line == "BARRIER") {
-        op = TestOp::BARRIER;
-        return;
+std::pair<int, int> IEngine<T>::keyRange(const std::optional<std::pair<int, int>> &prefill) const {
+    int low = std::numeric_limits<int>::max(), high = std::numeric_limits<int>::lowest();
+    if (prefill.has_value() && prefill->first < prefill->second) {
+        low  = prefill->first;
+        high = prefill->second - 1;
     }
+    for (auto &entry : currCase) {
+        if (isBarrier(entry)) continue;
+        low  = std::min(low, entry.key);
+        high = std::max(high, entry.key);
+    }
+    if (low > high) return {std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max()};
+    return {low, high};
+}
 
-    std::istringstream iss(line);
-    std::string tok;
-
-    std::getline(iss, tok, ',');
-    if (tok == "I") op = TestOp::INSERT;
-    else if (tok == "G") op = TestOp::GET;
-    else if (tok == "D") op = TestOp::REMOVE;
+template <template <typename> class T>
+void IEngine<T>::partitionCase(int threadNum) {
+    // Every thread sees every BARRIER, in trace order with respect to its own ops
+    streams.assign(threadNum, {});
+    int64_t low = 0, span = 1;
+    if (partition == Partition::KeyRange) {
+        int lowKey = std::numeric_limits<int>::max(), highKey = std::numeric_limits<int>::min();
+        for (const TestEntry &entry : currCase) {
+            if (isBarrier(entry)) continue;
+            lowKey  = std::min(lowKey, entry.key);
+            highKey = std::max(highKey, entry.key);
+        }
+        if (lowKey <= highKey) {
+            low  = lowKey;
+            span = static_cast<int64_t>(highKey) - lowKey + 1;
+        }
+    }
 
-    std::getline(iss, tok, ',');
-    value = std::stoi(tok);
+    size_t ops = 0;
+    for (const TestEntry &entry : currCase) {
+        if (isBarrier(entry)) {
+            for (auto &stream : streams) stream.push_back(entry);
+            continue;
+        }
+        size_t thread;
+        switch (partition) {
+        case Partition::Modulo:
+            thread = static_cast<size_t>((entry.key % threadNum + threadNum) % threadNum);
+            break;
+        case Partition::RoundRobin:
+            thread = ops % threadNum;
+            break;
+        case Partition::KeyRange:
+            thread = static_cast<size_t>((entry.key - low) * threadNum / span);
+            break;
+        }
+        streams[thread].push_back(entry);
+        ops ++;
+    }
+}
 
-    std::getline(iss, tok, ',');
-    if (tok == "NONE") expect = std::nullopt;
-    else expect = std::stoi(tok);
+template <template <typename> class T>
+bool IEngine<T>::TestCase::load(const std::string &filePath) {
+    mapped.close();
+    parsed.clear();
+    const std::string binarySuffix = ".bcase";
+    bool binary = filePath.size() >= binarySuffix.size() &&
+                  filePath.compare(filePath.size() - binarySuffix.size(), binarySuffix.size(), binarySuffix) == 0;
+    if (binary) {
+        if (!mapped.open(filePath)) return false;
+        entries = mapped.records();
+        count   = mapped.size();
+    } else {
+        if (!readTextTrace(filePath, parsed)) return false;
+        entries = parsed.data();
+        count   = parsed.size();
+    }
+    return true;
 }
 
 
 class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
     public:
+        /** What one rank measured over a case, gathered to rank 0 as raw bytes. */
+        struct RankStats {
+            LatencyHistogram insert, remove, get;   // ns, a get counts until progress() received its result
+            uint64_t ops        = 0;
+            uint64_t bytesSent  = 0;
+            uint64_t mismatches = 0;    // GETs and scans that disagreed with the case, only counted by checked runs
+            uint64_t rebalances = 0;    // Key ranges migrated, the same on every rank
+            uint64_t replicas   = 0;    // Key ranges replicated at the end of the run, the same on every rank
+            double   seconds    = 0;
+        };
+
         int repeatNum{};
         int numWorker{};
+        int getWindow{};
+        size_t rebalanceEvery{};
+        std::vector<std::pair<int, int>> replicaRanges;
+        int replicaCopies{};
+        bool replicateCase{};
+        Tree::RemoteRead remoteReads{};
+        bool checkResults{};
+        bool checkScans{};
         MPI_Comm world;
         std::optional<std::pair<int, int>> prefill;
 
@@ -491,17 +835,55 @@ class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
             this->repeatNum = 1;
             this->prefill = cfg.prefill;
             this->numWorker = cfg.numWorker;
+            this->getWindow = std::max(cfg.getWindow, 1);
+            this->rebalanceEvery = cfg.rebalanceEvery;
+            this->replicaRanges = cfg.replicaRanges;
+            this->replicaCopies = cfg.replicaCopies;
+            this->replicateCase = cfg.replicateCase;
+            this->remoteReads = cfg.remoteReads;
+            this->checkResults = cfg.checkResults;
+            this->checkScans = cfg.checkResults && cfg.checkScans;
         }
 
-        void inline Prefill(Tree::DistriBPlusTree<int> *tree, int start, int end) {
-            for (int elem = start; elem < end; elem ++) {
-                tree->insert(elem);
+        /**
+         * Replicate the keys the case touches, one range per owner since replicate() clips a range
+         * to the owner of its low end. The same on every rank, as replicate() is collective.
+         */
+        void ReplicateCase(Tree::DistriBPlusTree<int> *tree) {
+            auto [caseLow, caseHigh] = this->keyRange(std::nullopt);
+            if (caseHigh == std::numeric_limits<int>::max()) return;    // No keys, or no end to the range
+            for (int low = caseLow; low <= caseHigh; ) {
+                // ownerOf grows with the key, find the last key of the case low's owner holds
+                int owner = tree->ownerOf(low), first = low, last = caseHigh;
+                while (first < last) {
+                    int mid = first + (last - first + 1) / 2;
+                    if (tree->ownerOf(mid) == owner) first = mid;
+                    else                             last = mid - 1;
+                }
+                tree->replicate(low, first + 1, replicaCopies);
+                low = first + 1;
             }
         }
 
+        /** Every rank hands its own slice of the range to the collective bulk loader. */
+        void inline Prefill(Tree::DistriBPlusTree<int> *tree, int start, int end) {
+            int rank, world_size;
+            MPI_Comm_rank(world, &rank);
+            MPI_Comm_size(world, &world_size);
+            long span  = static_cast<long>(end) - start;
+            int  first = static_cast<int>(start + span * rank / world_size),
+                 last  = static_cast<int>(start + span * (rank + 1) / world_size);
+            std::vector<int> slice;
+            slice.reserve(std::max(last - first, 0));
+            for (int elem = first; elem < last; elem ++) slice.push_back(elem);
+            tree->bulkLoad(std::move(slice));
+        }
+
+        /** Key range of the prefill and the current case, the tree partitions it over the ranks. */
         void Run() override {
-            int rank;
+            int rank, world_size;
             MPI_Comm_rank(world, &rank);
+            MPI_Comm_size(world, &world_size);
 
             double average_qps = 0;
             for (size_t i = 0; i < this->paths.size(); i ++) {
@@ -509,10 +891,13 @@ class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
                 IEngine<Tree::DistriBPlusTree>::loadTestCase(testCase);
 
                 double run_seconds = 0.0f, build_seconds = 0.0f, del_seconds = 0.0f;
+                auto [keyLow, keyHigh] = keyRange(prefill);
+                RankStats stats;
 
                 for (int repeat = 0; repeat < repeatNum; repeat ++) {
                     Timer caseTimer;
-                    auto *tree = new Tree::DistriBPlusTree<int>(order, world);
+                    // numWorker is the number of server threads serving remote requests on each rank
+                    auto *tree = new Tree::DistriBPlusTree<int>(order, world, keyLow, keyHigh, numWorker, remoteReads);
                     build_seconds += caseTimer.elapsed();
 
                     // If have prefill, process the prefills first.
@@ -520,17 +905,30 @@ class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
                         int start = prefill->first, end = prefill->second;
                         Prefill(tree, start, end);
                     }
+                    for (auto [low, high] : replicaRanges) tree->replicate(low, high, replicaCopies);
+                    if (replicateCase) ReplicateCase(tree);
 
                     caseTimer.reset();
-                    runTestCase(tree);
+                    runTestCase(tree, stats);
 
                     run_seconds += caseTimer.elapsed();
+                    stats.bytesSent += tree->bytesSent();
+                    stats.rebalances += tree->numRebalances();
+                    stats.replicas   += tree->numReplicas();
 
                     caseTimer.reset();
                     delete tree;
                     del_seconds += caseTimer.elapsed();
                 }
 
+                stats.seconds = run_seconds;
+                std::vector<RankStats> ranks(rank == 0 ? world_size : 0);
+                MPI_Gather(&stats, sizeof(RankStats), MPI_BYTE, ranks.data(), sizeof(RankStats), MPI_BYTE, 0, world);
+
+                // The cluster is as fast as its slowest rank
+                if (rank == 0) {
+                    for (const RankStats &other : ranks) run_seconds = std::max(run_seconds, other.seconds);
+                }
                 run_seconds = run_seconds / repeatNum;
                 build_seconds = build_seconds / repeatNum;
                 del_seconds = del_seconds / repeatNum;
@@ -538,6 +936,14 @@ class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
                 float estimated_qps = static_cast<float>(this->currCase.size()) / run_seconds / 1000000.0f;
                 average_qps += estimated_qps;
                 
+                if (rank == 0 && checkResults) {
+                    uint64_t mismatches = 0;
+                    for (const RankStats &other : ranks) mismatches += other.mismatches;
+                    if (mismatches == 0) std::cout << "\r\033[1;32mPASS Case " << i << " " << testCase << "\033[0m" << std::endl;
+                    else std::cout << "\r\033[1;31mFAIL Case " << i << " " << testCase << ", " << mismatches
+                                   << " results disagree with the case\033[0m" << std::endl;
+                    assert(mismatches == 0);
+                }
                 if (rank == 0) {
                     std::cout << "\r\033[1;32mCase " << i << "\t " << testCase << "\033[0m" << "\t";
                 }
@@ -551,6 +957,7 @@ class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
                         toFixedLenStr(run_ms       , 4) << "ms, prep in " <<
                         toFixedLenStr(build_ms     , 4) << "ms, del in  " <<
                         toFixedLenStr(del_ms       , 4) << std::endl;
+                    printClusterStats(ranks);
                 }
             }
             if (rank == 0) {
@@ -571,57 +978,136 @@ class DistributeEngine : public IEngine<Tree::DistriBPlusTree> {
             return str;
         }
 
-        void runTestCase(Tree::DistriBPlusTree<int> *tree) {
+        /** Cluster throughput, latency percentiles over every rank and how uneven the ranks were. */
+        static void printClusterStats(const std::vector<RankStats> &ranks) {
+            RankStats cluster;
+            uint64_t maxOps = 0, maxBytes = 0;
+            double slowest = 0, fastest = std::numeric_limits<double>::max();
+            for (const RankStats &stats : ranks) {
+                cluster.insert.merge(stats.insert);
+                cluster.remove.merge(stats.remove);
+                cluster.get.merge(stats.get);
+                cluster.ops       += stats.ops;
+                cluster.bytesSent += stats.bytesSent;
+                maxOps   = std::max(maxOps, stats.ops);
+                maxBytes = std::max(maxBytes, stats.bytesSent);
+                slowest  = std::max(slowest, stats.seconds);
+                fastest  = std::min(fastest, stats.seconds);
+            }
+            double meanOps = static_cast<double>(cluster.ops) / ranks.size();
+
+            std::cout << std::fixed << std::setprecision(2)
+                      << "\tCluster: " << cluster.ops / slowest / 1000000.0 << " MQPS over " << ranks.size()
+                      << " ranks, ops skew " << (meanOps == 0 ? 0.0 : maxOps / meanOps)
+                      << " (max / mean), time skew " << (fastest == 0 ? 0.0 : slowest / fastest)
+                      << " (slowest / fastest), sent " << cluster.bytesSent / 1048576.0 << "MB (max rank "
+                      << maxBytes / 1048576.0 << "MB)";
+            if (ranks[0].rebalances != 0) std::cout << ", " << ranks[0].rebalances << " ranges migrated";
+            if (ranks[0].replicas   != 0) std::cout << ", " << ranks[0].replicas << " ranges replicated";
+            std::cout << std::endl;
+            std::cout << "\t  op            count    p50(us)    p99(us)   p999(us)" << std::endl;
+            auto printOp = [](const char *name, const LatencyHistogram &hist) {
+                if (hist.count() == 0) return;
+                std::cout << "\t  " << std::left << std::setw(8) << name << std::right
+                          << std::setw(11) << hist.count()
+                          << std::setw(11) << hist.percentile(50)   / 1000.0
+                          << std::setw(11) << hist.percentile(99)   / 1000.0
+                          << std::setw(11) << hist.percentile(99.9) / 1000.0 << std::endl;
+            };
+            printOp("INSERT", cluster.insert);
+            printOp("REMOVE", cluster.remove);
+            printOp("GET", cluster.get);
+            std::cout << "\t  rank          ops    time(ms)       MQPS    sent(MB)" << std::endl;
+            for (size_t idx = 0; idx < ranks.size(); idx ++) {
+                const RankStats &stats = ranks[idx];
+                std::cout << "\t  " << std::left << std::setw(8) << idx << std::right
+                          << std::setw(11) << stats.ops
+                          << std::setw(12) << stats.seconds * 1000
+                          << std::setw(11) << (stats.seconds == 0 ? 0.0 : stats.ops / stats.seconds / 1000000.0)
+                          << std::setw(12) << stats.bytesSent / 1048576.0 << std::endl;
+            }
+            std::cout.unsetf(std::ios_base::floatfield);
+        }
+
+        void runTestCase(Tree::DistriBPlusTree<int> *tree, RankStats &stats) {
             int world_size, rank;
             MPI_Comm_size(world, &world_size);
             MPI_Comm_rank(world, &rank);
 
+            struct InflightGet {
+                typename Tree::DistriBPlusTree<int>::GetHandle handle;
+                uint64_t start;
+                std::optional<int> expect;
+            };
+            // A get is timed until progress() resolved it, not until the window reached it
+            auto retire = [&](InflightGet &get) {
+                std::optional<int> result = get.handle.wait();
+                stats.get.record(get.handle.completedNs() - get.start);
+                if (checkResults && result != get.expect) stats.mismatches ++;
+            };
+            auto issuerOf = [&](int key) {return (key % world_size + world_size) % world_size;};
+
+            // A scan must return exactly the keys of this rank's share the case holds so far
+            std::set<int> held;
+            auto [keyLow, keyHigh] = this->keyRange(std::nullopt);
+            auto checkScan = [&]() {
+                std::vector<int> seen;
+                auto cursor = tree->scan(keyLow, keyHigh == std::numeric_limits<int>::max() ? keyHigh : keyHigh + 1);
+                for (auto key = cursor.next(); key.has_value(); key = cursor.next()) {
+                    if (issuerOf(*key) == rank) seen.push_back(*key);
+                }
+                if (!std::equal(seen.begin(), seen.end(), held.begin(), held.end())) stats.mismatches ++;
+            };
+
+            // Gets are pipelined, the oldest one is retired once getWindow are in flight
+            std::deque<InflightGet> inflight;
             for (size_t idx = 0; idx < this->currCase.size(); idx ++) {
                 auto entry = this->currCase[idx];
-                if (idx % world_size != rank) continue;
+                // Every rank walks every index, so all of them reach the (collective) rebalance together
+                if (rebalanceEvery != 0 && idx != 0 && idx % rebalanceEvery == 0) tree->rebalance();
+                if (isBarrier(entry)) {
+                    if (checkScans) checkScan();
+                    continue;
+                }
+                // A checked run keeps each key on one rank, so its ops reach the tree in trace order
+                int issuer = checkResults ? issuerOf(entry.key) : static_cast<int>(idx % world_size);
+                if (issuer != rank) continue;
+                uint64_t start = nowNs();
                 switch (entry.op){
                     case IEngine<Tree::DistriBPlusTree>::TestOp::INSERT:
-                        tree->insert(entry.value);
+                        tree->insert(entry.key);
+                        stats.insert.record(nowNs() - start);
+                        if (checkScans) held.insert(entry.key);
                         break;
                     case IEngine<Tree::DistriBPlusTree>::TestOp::REMOVE:
-                        tree->remove(entry.value);
+                        tree->remove(entry.key);
+                        stats.remove.record(nowNs() - start);
+                        if (checkScans) held.erase(entry.key);
                         break;
                     case IEngine<Tree::DistriBPlusTree>::TestOp::GET:
-                        tree->get(entry.value);
+                        inflight.push_back({tree->get_async(entry.key), start, expect(entry)});
+                        if (inflight.size() >= static_cast<size_t>(getWindow)) {
+                            retire(inflight.front());
+                            inflight.pop_front();
+                        }
                         break;
-                    case IEngine<Tree::DistriBPlusTree>::TestOp::BARRIER:
+                    default:
                         break;
                 }
+                // Results that already arrived are stamped now rather than when their handle is waited on
+                if (!inflight.empty()) tree->progress(false);
+                stats.ops ++;
             }
+            for (; !inflight.empty(); inflight.pop_front()) retire(inflight.front());
         }
     };
 
-template <template <typename> class T>
-void IEngine<T>::TestEntry::print() {
-    if (op == TestOp::GET) std::cout << "GET ";
-    else if (op == TestOp::INSERT) std::cout << "INSERT ";
-    else if (op == TestOp::REMOVE) std::cout << "DELETE ";
-    else std::cout << "BARRIER ";
-
-    if (expect.has_value()) {
-        std::cout << "\t" << value << ", expect: " << expect.value() << std::endl;
-    } else {
-        std::cout << "\t" << value << ", expect: NONE" << std::endl;
-    }
-}
-
 template <template <typename> class T>
 void IEngine<T>::loadTestCase(const std::string &filePath) {
-    currCase.clear();
-    std::ifstream file(filePath);
-    std::string   line;
-    if (!file) {
+    if (!currCase.load(filePath)) {
         std::cerr << "Unable to load file at " << filePath;
         assert(false);
     }
-    while (std::getline(file, line)) {
-        currCase.emplace_back(line);
-    }
 }
 
 };
@@ -0,0 +1,198 @@
+#pragma once
+#include "tree.h"
+
+/**
+ * NOTE: A remover that rebalances a leaf holds it and may wait for the latch of its packed
+ * neighbour (see thawSibling), so a cursor never waits for a neighbour leaf while it holds one.
+ * It only try-latches the neighbour; if that fails it lets go of its leaf and searches for the
+ * next key from the root, latching top-down like every writer.
+ * Sibling borrow / merge on removal update the neighbour leaf under its parent's latch only,
+ * so a cursor running next to writers sees every leaf atomically w.r.t. inserts and removals
+ * into that leaf, but is only an exact snapshot while writers are quiescent.
+ */
+
+namespace Tree {
+    template <typename T, int Order>
+    FineLockBPlusTree<T, Order>::Iterator::Iterator(FineNode<T, Order> *root, FineNode<T, Order> *leaf, size_t index, T from):
+        root(root), leaf(leaf), index(index), bound(from), after(false) {
+        skipForward();
+    }
+
+    template <typename T, int Order>
+    FineLockBPlusTree<T, Order>::Iterator::Iterator(Iterator &&other) noexcept:
+        root(other.root), leaf(other.leaf), index(other.index), bound(other.bound), after(other.after) {
+        other.leaf = nullptr;
+    }
+
+    template <typename T, int Order>
+    typename FineLockBPlusTree<T, Order>::Iterator &FineLockBPlusTree<T, Order>::Iterator::operator=(Iterator &&other) noexcept {
+        if (this != &other) {
+            release();
+            root  = other.root;
+            leaf  = other.leaf;
+            index = other.index;
+            bound = other.bound;
+            after = other.after;
+            other.leaf = nullptr;
+        }
+        return *this;
+    }
+
+    template <typename T, int Order>
+    FineLockBPlusTree<T, Order>::Iterator::~Iterator() {
+        release();
+    }
+
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::Iterator::release() {
+        if (leaf != nullptr) leaf->latch.unlock_shared();
+        leaf = nullptr;
+    }
+
+    /** Move on until index is inside a leaf, or to end(). */
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::Iterator::skipForward() {
+        while (leaf != nullptr && index >= leaf->numKeys()) {
+            FineNode<T, Order> *next = leaf->next;
+            if (next == nullptr || next->latch.try_lock_shared()) {
+                release();
+                leaf  = next;
+                index = 0;
+            } else {
+                // The leaf may be empty while a remover rebalances it, so restart from bound
+                seek(bound, after);
+            }
+        }
+    }
+
+    /**
+     * Release the current leaf and crab down from the root to the first key greater than key
+     * (after) or not less than key. The position may be past the end of the leaf it lands in.
+     */
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::Iterator::seek(T key, bool after) {
+        release();
+        FineNode<T, Order> *node = root;
+        node->latch.lock_shared();
+        while (!node->isLeaf) {
+            auto bound = after ? std::upper_bound(node->keys.begin(), node->keys.end(), key)
+                               : std::lower_bound(node->keys.begin(), node->keys.end(), key);
+            FineNode<T, Order> *child = node->children[bound - node->keys.begin()];
+            child->latch.lock_shared();
+            node->latch.unlock_shared();
+            node = child;
+        }
+        size_t low = 0, high = node->numKeys();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (after ? !(key < node->keyAt(mid)) : node->keyAt(mid) < key) low = mid + 1;
+            else                                                           high = mid;
+        }
+        leaf  = node;
+        index = low;
+    }
+
+    template <typename T, int Order>
+    T FineLockBPlusTree<T, Order>::Iterator::operator*() const {
+        DBG_ASSERT(leaf != nullptr);
+        return leaf->keyAt(index);
+    }
+
+    template <typename T, int Order>
+    typename FineLockBPlusTree<T, Order>::Iterator &FineLockBPlusTree<T, Order>::Iterator::operator++() {
+        bound = leaf->keyAt(index);
+        after = true;
+        index ++;
+        skipForward();
+        return *this;
+    }
+
+    template <typename T, int Order>
+    typename FineLockBPlusTree<T, Order>::Iterator &FineLockBPlusTree<T, Order>::Iterator::operator--() {
+        if (leaf == nullptr) {
+            // Step back from end(), crab down to the right-most leaf
+            FineNode<T, Order> *node = root;
+            node->latch.lock_shared();
+            while (!node->isLeaf) {
+                FineNode<T, Order> *child = node->children.back();
+                child->latch.lock_shared();
+                node->latch.unlock_shared();
+                node = child;
+            }
+            leaf  = node;
+            index = leaf->numKeys();
+            bound = std::numeric_limits<T>::max();
+            after = true;
+        }
+        while (index == 0 && leaf->prev != nullptr) {
+            FineNode<T, Order> *prev = leaf->prev;
+            if (prev->latch.try_lock_shared()) {
+                release();
+                leaf  = prev;
+                index = leaf->numKeys();
+            } else {
+                // Same as skipForward: never wait for a neighbour while holding a leaf
+                seek(bound, after);
+            }
+        }
+        DBG_ASSERT(index > 0);  // Decrementing begin() is undefined
+        index --;
+        bound = leaf->keyAt(index);
+        after = false;
+        return *this;
+    }
+
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::Iterator::operator==(const Iterator &other) const {
+        return leaf == other.leaf && (leaf == nullptr || index == other.index);
+    }
+
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::Iterator::operator!=(const Iterator &other) const {
+        return !(*this == other);
+    }
+
+    template <typename T, int Order>
+    typename FineLockBPlusTree<T, Order>::Iterator FineLockBPlusTree<T, Order>::begin() {
+        FineNode<T, Order> *node = &rootPtr;
+        node->latch.lock_shared();
+        while (!node->isLeaf) {
+            FineNode<T, Order> *child = node->children[0];
+            child->latch.lock_shared();
+            node->latch.unlock_shared();
+            node = child;
+        }
+        return Iterator(&rootPtr, node, 0);
+    }
+
+    template <typename T, int Order>
+    typename FineLockBPlusTree<T, Order>::Iterator FineLockBPlusTree<T, Order>::end() {
+        return Iterator(&rootPtr, nullptr, 0);
+    }
+
+    /** Copies of key may sit on both sides of an equal separator, so descend left of it. */
+    template <typename T, int Order>
+    typename FineLockBPlusTree<T, Order>::Iterator FineLockBPlusTree<T, Order>::lowerBound(T key) {
+        FineNode<T, Order> *node = &rootPtr;
+        node->latch.lock_shared();
+        while (!node->isLeaf) {
+            size_t index = std::lower_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin();
+            FineNode<T, Order> *child = node->children[index];
+            child->latch.lock_shared();
+            node->latch.unlock_shared();
+            node = child;
+        }
+        size_t low = 0, high = node->numKeys();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (node->keyAt(mid) < key) low = mid + 1;
+            else                        high = mid;
+        }
+        return Iterator(&rootPtr, node, low, key);
+    }
+
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::forEach(const std::function<void(const T&)> &visitor) {
+        for (Iterator it = begin(), last = end(); it != last; ++it) visitor(*it);
+    }
+}
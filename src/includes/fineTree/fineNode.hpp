@@ -4,23 +4,23 @@
 #include "../tree.h"
 
 namespace Tree {
-    template <typename T>
-    void FineNode<T>::releaseAll() {
+    template <typename T, int Order>
+    void FineNode<T, Order>::releaseAll() {
         if (!isLeaf) {
             for (auto child : children) child->releaseAll();
         }
         delete this;
     }
 
-    template <typename T>
-    T getMin(FineNode<T>* node) {
+    template <typename T, int Order>
+    T getMin(FineNode<T, Order>* node) {
         while (!node->isLeaf) node = node->children[0];
-        return node->keys[0];
+        return node->keyAt(0);
     }
 
-    template <typename T>
-    bool FineNode<T>::debug_checkParentPointers() {
-        for (Tree::FineNode<T>* child : children) {
+    template <typename T, int Order>
+    bool FineNode<T, Order>::debug_checkParentPointers() {
+        for (Tree::FineNode<T, Order>* child : children) {
             if (child->parent != this) 
                 return false;
             if (!(child->isLeaf || child->debug_checkParentPointers())) 
@@ -30,19 +30,20 @@ namespace Tree {
         return  !(this->parent != nullptr && this->parent->children[childIndex] != this);
     }
     
-    template <typename T>
-    void FineNode<T>::printKeys() {
+    template <typename T, int Order>
+    void FineNode<T, Order>::printKeys() {
         std::cout << "[";
         for (int i = 0; i < numKeys(); i ++) {
-            std::cout << keys[i];
+            std::cout << keyAt(i);
             if (i != numKeys() - 1) std::cout << ",";
         }
         std::cout << "]";
     }
 
-    template <typename T>
-    bool FineNode<T>::debug_checkOrdering(std::optional<T> lower, std::optional<T> upper) {
-        for (const auto key : this->keys) {
+    template <typename T, int Order>
+    bool FineNode<T, Order>::debug_checkOrdering(std::optional<T> lower, std::optional<T> upper) {
+        for (size_t idx = 0; idx < numKeys(); idx ++) {
+            const T key = keyAt(idx);
             if (lower.has_value() && key < lower.value()) {                
                 return false;
             }
@@ -68,8 +69,8 @@ namespace Tree {
         return true;
     }
     
-    template <typename T>
-    bool FineNode<T>::debug_checkChildCnt(int ordering) {
+    template <typename T, int Order>
+    bool FineNode<T, Order>::debug_checkChildCnt(int ordering) {
         if (this->isLeaf) {
             return numChild() == 0;
         }
@@ -83,11 +84,31 @@ namespace Tree {
         return true;
     }
 
-    template <typename T>
-    void FineNode<T>::consolidateChild() {
+    template <typename T, int Order>
+    void FineNode<T, Order>::consolidateChild() {
         for (size_t id = 0; id < numChild(); id ++) {
             children[id]->parent = this;
             children[id]->childIndex = id;
         }
     }
+
+    /** Freeze a leaf into the packed format, returns false if packing would not save space. */
+    template <typename T, int Order>
+    bool FineNode<T, Order>::pack() {
+        if (!isLeaf || isDummy || isPacked()) return false;
+        uint8_t width = LeafCodec<T>::widthFor(keys);
+        if (width == 0) return false;
+        LeafCodec<T>::encode(keys, width);
+        packWidth = width;
+        return true;
+    }
+
+    /** Bring a leaf back to raw keys before it is written, and mark it as hot. */
+    template <typename T, int Order>
+    void FineNode<T, Order>::thaw() {
+        hot = true;
+        if (!isPacked()) return;
+        LeafCodec<T>::decode(keys, packWidth, Order);
+        packWidth = 0;
+    }
 }
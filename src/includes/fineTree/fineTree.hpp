@@ -5,46 +5,50 @@
 #include <optional>
 #include "tree.h"
 #include "fineTree/lockQueue.hpp"
+#include "fineTree/fineIterator.hpp"
 #include "fineTree/fineNode.hpp"
 
 namespace Tree {
-    template<typename T>
-    FineLockBPlusTree<T>::FineLockBPlusTree(int order): ORDER_(order), size_(0), rootPtr(FineNode<T>(true, true)) {}
+    template <typename T, int Order>
+    FineLockBPlusTree<T, Order>::FineLockBPlusTree(int order): ORDER_(order), size_(0), rootPtr(FineNode<T, Order>(true, true)) {
+        assert(Order == 0 || order == Order);
+    }
 
-    template <typename T>
-    FineNode<T> *FineLockBPlusTree<T>::getRoot() {
+    template <typename T, int Order>
+    FineNode<T, Order> *FineLockBPlusTree<T, Order>::getRoot() {
         return &rootPtr;
     }
 
-    template <typename T>
-    int FineLockBPlusTree<T>::size() {
+    template <typename T, int Order>
+    int FineLockBPlusTree<T, Order>::size() {
         return size_;
     }
 
-    template <typename T>
-    FineLockBPlusTree<T>::~FineLockBPlusTree() {
+    template <typename T, int Order>
+    FineLockBPlusTree<T, Order>::~FineLockBPlusTree() {
         if (rootPtr.numChild() != 0) rootPtr.children[0]->releaseAll();
     }
 
-    template <typename T>
-    void FineLockBPlusTree<T>::insert(T key) {
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::insert(T key) {
         size_ ++;
 
-        LockManager<T> dq = LockManager<T>(false);
-        FineNode<T> *node = findLeafNodeInsert(&rootPtr, key, dq);
+        LockManager<T, Order> dq = LockManager<T, Order>(false);
+        FineNode<T, Order> *node = findLeafNodeInsert(&rootPtr, key, dq);
         DBG_ASSERT(dq.isLocked(node));
 
         if (node == &rootPtr) {
-            FineNode<T> *root = new FineNode<T>(true);
+            FineNode<T, Order> *root = new FineNode<T, Order>(true);
             insertKey(root, key);
 
             rootPtr.children.push_back(root);
             rootPtr.isLeaf = false;
             rootPtr.consolidateChild();
         } else {
+            node->thaw();
             insertKey(node, key);
 
-            if (node->numKeys() >= ORDER_) {
+            if (node->numKeys() >= order()) {
                 DBG_ASSERT(dq.isLocked(node->parent));
                 splitNode(node, key);
             }
@@ -53,15 +57,15 @@ namespace Tree {
         dq.releaseAll();
     }
 
-    template <typename T>
-    FineNode<T>* FineLockBPlusTree<T>::findLeafNodeRead(FineNode<T>* node, T key, LockManager<T> &dq) {
+    template <typename T, int Order>
+    FineNode<T, Order>* FineLockBPlusTree<T, Order>::findLeafNodeRead(FineNode<T, Order>* node, T key, LockManager<T, Order> &dq) {
         DBG_ASSERT(node == &rootPtr);
         dq.retrieveLock(node);
 
         while (!node->isLeaf) {
             /** getGTKeyIdx will have index = 0 if node is dummy node */
             size_t index = node->getGtKeyIdx(key);
-            FineNode<T> *child = node->children[index];
+            FineNode<T, Order> *child = node->children[index];
 
             dq.retrieveLock(child);
             dq.releasePrev();
@@ -71,19 +75,21 @@ namespace Tree {
         return node;
     }
 
-    template <typename T>
-    FineNode<T>* FineLockBPlusTree<T>::findLeafNodeInsert(FineNode<T>* node, T key, LockManager<T> &dq) {
+    template <typename T, int Order>
+    FineNode<T, Order>* FineLockBPlusTree<T, Order>::findLeafNodeInsert(FineNode<T, Order>* node, T key, LockManager<T, Order> &dq) {
         DBG_ASSERT(node == &rootPtr);
         dq.retrieveLock(node);
 
         while (!node->isLeaf) {
-            if (node->numKeys() + 1 < ORDER_) {
+            if (node->numKeys() + 1 < order()) {
                 dq.releasePrev();
+            } else {
+                LOCK_PROFILE_DO(LockProfile::local().unsafeNodes ++;)
             }
 
             /** getGTKeyIdx will have index = 0 if node is dummy node */
             size_t index = node->getGtKeyIdx(key);
-            FineNode<T> *child = node->children[index];
+            FineNode<T, Order> *child = node->children[index];
             dq.retrieveLock(child);
             
             node = child;
@@ -92,34 +98,36 @@ namespace Tree {
         return node;
     }
 
-    template <typename T>
-    FineNode<T>* FineLockBPlusTree<T>::findLeafNodeDelete(FineNode<T>* node, T key, LockManager<T> &dq) {
+    template <typename T, int Order>
+    FineNode<T, Order>* FineLockBPlusTree<T, Order>::findLeafNodeDelete(FineNode<T, Order>* node, T key, LockManager<T, Order> &dq) {
         DBG_ASSERT(node == &rootPtr);
         dq.retrieveLock(node);
 
         while (!node->isLeaf) {
             if (moreHalfFull(node)) {
                 dq.releasePrev();
+            } else {
+                LOCK_PROFILE_DO(LockProfile::local().unsafeNodes ++;)
             }
             /** getGTKeyIdx will have index = 0 if node is dummy node */
             size_t index = node->getGtKeyIdx(key);
-            FineNode<T> *child = node->children[index];
+            FineNode<T, Order> *child = node->children[index];
             dq.retrieveLock(child);
             node = child;
         }
         return node;
     }
     
-    template <typename T>
-    void FineLockBPlusTree<T>::insertKey(FineNode<T>* node, T key) {
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::insertKey(FineNode<T, Order>* node, T key) {
         size_t index = node->getGtKeyIdx(key);
         node->keys.insert(node->keys.begin() + index, key);
     }
 
-    template <typename T>
-    void FineLockBPlusTree<T>::splitNode(FineNode<T>* node, T key) {
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::splitNode(FineNode<T, Order>* node, T key) {
         DBG_ASSERT(node != &rootPtr);
-        FineNode<T> *new_node = new FineNode<T>(node->isLeaf);
+        FineNode<T, Order> *new_node = new FineNode<T, Order>(node->isLeaf);
         auto middle   = node->numKeys() / 2;
         auto mid_key  = node->keys[middle];
 
@@ -199,7 +207,7 @@ namespace Tree {
              * the left-most and right-most child.
              */
             assert (newNodeOnRight);
-            FineNode<T> *new_root = new FineNode<T>(false);
+            FineNode<T, Order> *new_root = new FineNode<T, Order>(false);
             new_root->children.push_back(node);
             new_root->children.push_back(new_node);
             
@@ -221,7 +229,7 @@ namespace Tree {
              * register new_node into some parent node and maybe recursively split the 
              * parent if needed.
              */
-            FineNode<T> *parent = node->parent;
+            FineNode<T, Order> *parent = node->parent;
             size_t index = node->childIndex;
                         
             if (newNodeOnRight) {
@@ -267,14 +275,14 @@ namespace Tree {
             /**
              * If the parent is too full, split the parent node recursively.
              */
-            if (parent->numKeys() >= ORDER_) splitNode(parent, key);
+            if (parent->numKeys() >= order()) splitNode(parent, key);
         }
     }
 
-    template <typename T>
-    std::optional<T> FineLockBPlusTree<T>::get(T key) {
-        LockManager<T> dq = LockManager<T>(true);
-        FineNode<T> *node = findLeafNodeRead(&rootPtr, key, dq);
+    template <typename T, int Order>
+    std::optional<T> FineLockBPlusTree<T, Order>::get(T key) {
+        LockManager<T, Order> dq = LockManager<T, Order>(true);
+        FineNode<T, Order> *node = findLeafNodeRead(&rootPtr, key, dq);
 
         DBG_ASSERT(dq.isLocked(node));
 
@@ -289,6 +297,12 @@ namespace Tree {
 //            dq.releaseAll();
 //            return key;
 //        }
+        if (node->isPacked()) {
+            bool found = node->hasKey(key);
+            dq.releaseAll();
+            if (found) return key;
+            return std::nullopt;
+        }
         auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
         int index = std::distance(node->keys.begin(), it);
 
@@ -301,20 +315,20 @@ namespace Tree {
         return std::nullopt; // Key not found
     }
 
-    template <typename T>
-    bool FineLockBPlusTree<T>::isHalfFull(FineNode<T>* node) {
-        return node->numKeys() >= ((ORDER_-1) / 2);
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::isHalfFull(FineNode<T, Order>* node) {
+        return node->numKeys() >= ((order()-1) / 2);
     }
 
-    template <typename T>
-    bool FineLockBPlusTree<T>::moreHalfFull(FineNode<T>* node) {
-        return node->numKeys() > ((ORDER_-1) / 2);
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::moreHalfFull(FineNode<T, Order>* node) {
+        return node->numKeys() > ((order()-1) / 2);
     }
 
-    template <typename T>
-    bool FineLockBPlusTree<T>::remove(T key) {
-        LockManager<T> dq = LockManager<T>(false);
-        FineNode<T>* node = findLeafNodeDelete(&rootPtr, key, dq);
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::remove(T key) {
+        LockManager<T, Order> dq = LockManager<T, Order>(false);
+        FineNode<T, Order>* node = findLeafNodeDelete(&rootPtr, key, dq);
         DBG_ASSERT(dq.isLocked(node));
         /**
          * NOTE: If the tree is empty, then node must be rootPtr
@@ -356,8 +370,8 @@ namespace Tree {
         return true;
     }
 
-    template <typename T>
-    void FineLockBPlusTree<T>::removeBorrow(FineNode<T> *node, LockManager<T> &dq) {
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::removeBorrow(FineNode<T, Order> *node, LockManager<T, Order> &dq) {
         // Edge case: root has no sibling node to borrow with
         if (node->parent == &rootPtr) {
             if (node->numKeys() == 0) {
@@ -387,8 +401,9 @@ namespace Tree {
              * 1. try to borrow from left node (node -> prev)
              * 2. If 1) failed, try to merge with left node (node -> prev)
              */
-            FineNode<T> *leftNode = node->prev;
+            FineNode<T, Order> *leftNode = node->prev;
             DBG_ASSERT(leftNode->parent == node->parent);
+            thawSibling(leftNode);
             if (moreHalfFull(leftNode)) {
                 size_t index = leftNode->childIndex;
                 if (!node->isLeaf) {
@@ -430,8 +445,9 @@ namespace Tree {
              * 1. try to borrow from right node (node -> next)
              * 2. If 1) failed, try to merge with right node (node -> next)
              */
-            FineNode<T> *rightNode = node->next;
+            FineNode<T, Order> *rightNode = node->next;
             DBG_ASSERT(rightNode->parent == node->parent);
+            thawSibling(rightNode);
 
             if (moreHalfFull(rightNode)) {
                 size_t index = node->childIndex;
@@ -474,10 +490,10 @@ namespace Tree {
         }
     }
 
-    template <typename T>
-    void FineLockBPlusTree<T>::removeMerge(FineNode<T>* node, LockManager<T> &dq) {
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::removeMerge(FineNode<T, Order>* node, LockManager<T, Order> &dq) {
         bool leftMergeToRight;
-        FineNode<T> *leftNode, *rightNode, *parent;
+        FineNode<T, Order> *leftNode, *rightNode, *parent;
 
         /**
          * NOTE: No need to handle root here since we always first try to borrow
@@ -603,18 +619,37 @@ namespace Tree {
         if (!isHalfFull(parent)) removeBorrow(parent, dq);
     }
     
-    template <typename T>
-    bool FineLockBPlusTree<T>::removeFromLeaf(FineNode<T>* node, T key) {
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::removeFromLeaf(FineNode<T, Order>* node, T key) {
+        // A miss leaves a packed leaf packed
+        if (node->isPacked()) {
+            if (!node->hasKey(key)) return false;
+            node->thaw();
+        }
         auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
         if (it != node->keys.end() && *it == key) {
             node->keys.erase(it);
+            node->hot = true;
             return true;
         }
         return false;
     }
 
-    template <typename T>
-    bool FineLockBPlusTree<T>::debug_checkIsValid(bool verbose) {
+    /**
+     * Siblings are modified under their parent's latch only, but a reader may still be inside
+     * a packed sibling (it released the parent already). Thawing reallocates the keys, so wait
+     * for such readers by taking the sibling's latch. Only a packed sibling is latched, and
+     * cursors never wait for a leaf while holding its neighbour (see fineIterator.hpp).
+     */
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::thawSibling(FineNode<T, Order>* node) {
+        if (!node->isLeaf || !node->isPacked()) return;
+        std::unique_lock<std::shared_mutex> guard(node->latch);
+        node->thaw();
+    }
+
+    template <typename T, int Order>
+    bool FineLockBPlusTree<T, Order>::debug_checkIsValid(bool verbose) {
         if (!rootPtr.isDummy) return false;
         if (rootPtr.numChild() == 0) return size_ == 0;
         if (rootPtr.numChild() > 1) return false;
@@ -629,14 +664,14 @@ namespace Tree {
         if (!isValidOrdering)  return false;
 
         // checking number of key/children
-        bool isValidChildCnt = rootPtr.children[0]->debug_checkChildCnt(ORDER_);
+        bool isValidChildCnt = rootPtr.children[0]->debug_checkChildCnt(order());
         if (!isValidChildCnt) return false;
 
-        Tree::FineNode<T>* src = rootPtr.children[0];
+        Tree::FineNode<T, Order>* src = rootPtr.children[0];
         do {
             if (src->numChild() == 0) break;
             src = src->children[0];
-            FineNode<T> *ckptr = src;
+            FineNode<T, Order> *ckptr = src;
 
             // Check the leaf nodes linked list
             while (ckptr->next != nullptr) {
@@ -648,7 +683,7 @@ namespace Tree {
                     return false;
                 }
 
-                if (ckptr->next->keys[0] < ckptr->keys.back()) {
+                if (ckptr->next->keyAt(0) < ckptr->keyAt(ckptr->numKeys() - 1)) {
                     std::cerr << "Leaves not well-ordered!\nI will try to print the tree to help debugging:" << std::endl;
                     std::cout << "\033[1;31m FAILED";
                     this->print();
@@ -674,18 +709,18 @@ namespace Tree {
         return true;
     }
 
-    template <typename T>
-    void FineLockBPlusTree<T>::print() {
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::print() {
         
         std::cout << "[Sequential B+ Tree]" << std::endl;
         if (rootPtr.numChild() == 0) {
             std::cout << "(Empty)" << std::endl;
             return;
         }
-        FineNode<T>* src = &rootPtr;
+        FineNode<T, Order>* src = &rootPtr;
         int level_cnt = 0;
         do {
-            FineNode<T>* ptr = src;
+            FineNode<T, Order>* ptr = src;
             std::cout << level_cnt << "\t| ";
             while (ptr != nullptr) {
                 ptr->printKeys();
@@ -701,18 +736,95 @@ namespace Tree {
         std::cout << std::endl;
     }
 
-    template <typename T>
-    std::vector<T> FineLockBPlusTree<T>::toVec() {
-        FineNode<T> *ptr = &rootPtr;
+    template <typename T, int Order>
+    std::vector<T> FineLockBPlusTree<T, Order>::toVec() {
+        FineNode<T, Order> *ptr = &rootPtr;
         std::vector<T> vec;
         if (ptr == nullptr) return vec;
         
         for (; !ptr->isLeaf; ptr = ptr->children[0]){}
         while (ptr != nullptr) {
-            for (T &key : ptr->keys) vec.push_back(key);
+            ptr->forEachKey([&vec](T key) { vec.push_back(key); });
             ptr = ptr->next;
         }
         return vec;
     }
-};
 
+    /**
+     * Nodes of a level are split as evenly as possible, so with more than one node on a level
+     * each is at least half full. A separator is the smallest key of the subtree on its right.
+     */
+    template <typename T, int Order>
+    void FineLockBPlusTree<T, Order>::buildSorted(const std::vector<T> &keys) {
+        DBG_ASSERT(std::is_sorted(keys.begin(), keys.end()));
+        assert(rootPtr.numChild() == 0);
+        if (keys.empty()) return;
+
+        std::vector<FineNode<T, Order>*> level;
+        std::vector<T> lowest;      // Smallest key under level[i]
+        size_t maxKeys   = order() - 1;
+        size_t numLeaves = (keys.size() + maxKeys - 1) / maxKeys;
+        for (size_t idx = 0; idx < numLeaves; idx ++) {
+            size_t first = keys.size() * idx / numLeaves, last = keys.size() * (idx + 1) / numLeaves;
+            FineNode<T, Order> *leaf = new FineNode<T, Order>(true);
+            leaf->keys.assign(keys.begin() + first, keys.begin() + last);
+            level.push_back(leaf);
+            lowest.push_back(keys[first]);
+        }
+
+        while (true) {
+            for (size_t idx = 0; idx < level.size(); idx ++) {
+                level[idx]->prev = idx == 0 ? nullptr : level[idx - 1];
+                level[idx]->next = idx + 1 == level.size() ? nullptr : level[idx + 1];
+            }
+            if (level.size() == 1) break;
+
+            std::vector<FineNode<T, Order>*> parents;
+            std::vector<T> parentLowest;
+            size_t maxChildren = order();
+            size_t numParents  = (level.size() + maxChildren - 1) / maxChildren;
+            for (size_t idx = 0; idx < numParents; idx ++) {
+                size_t first = level.size() * idx / numParents, last = level.size() * (idx + 1) / numParents;
+                FineNode<T, Order> *parent = new FineNode<T, Order>(false);
+                parent->children.assign(level.begin() + first, level.begin() + last);
+                parent->keys.assign(lowest.begin() + first + 1, lowest.begin() + last);
+                parent->consolidateChild();
+                parents.push_back(parent);
+                parentLowest.push_back(lowest[first]);
+            }
+            level.swap(parents);
+            lowest.swap(parentLowest);
+        }
+
+        rootPtr.children.push_back(level[0]);
+        rootPtr.isLeaf = false;
+        rootPtr.consolidateChild();
+        size_ = static_cast<int>(keys.size());
+    }
+
+    template <typename T, int Order>
+    size_t FineLockBPlusTree<T, Order>::compactLeaves(double minFill, bool coldOnly) {
+        FineNode<T, Order> *ptr = &rootPtr;
+        for (; !ptr->isLeaf; ptr = ptr->children[0]) {}
+
+        const size_t minKeys = static_cast<size_t>(minFill * (order() - 1));
+        size_t packed = 0;
+        for (; ptr != nullptr; ptr = ptr->next) {
+            std::unique_lock<std::shared_mutex> guard(ptr->latch);
+            bool cold = !(coldOnly && ptr->hot);
+            ptr->hot  = false;
+            if (cold && ptr->numKeys() >= minKeys && ptr->pack()) packed ++;
+        }
+        return packed;
+    }
+
+    /** Same accounting as SeqBPlusTree::memoryStats, FineNode also carries its latch. */
+    template <typename T, int Order>
+    MemoryStats FineLockBPlusTree<T, Order>::memoryStats() {
+        MemoryStats stats;
+        stats.maxKeysPerNode = order() - 1;
+        stats.otherBytes     = sizeof(*this) + containerBytes(rootPtr.children);
+        for (FineNode<T, Order> *root : rootPtr.children) collectMemoryStats(root, stats);
+        return stats;
+    }
+};
@@ -1,24 +1,37 @@
 #include "tree.h"
 
 namespace Tree {
-    template <typename T>
-    void LockManager<T>::retrieveLock(FineNode<T> *ptr) {
+    template <typename T, int Order>
+    void LockManager<T, Order>::retrieveLock(FineNode<T, Order> *ptr) {
+#ifdef LOCK_PROFILE
+        uint64_t waitBegin = nowNs();
+#endif
         if (isShared) ptr->latch.lock_shared();
         else ptr->latch.lock();
+        LOCK_PROFILE_DO(
+            acquiredAt[end] = nowNs();
+            LockProfile::local().onAcquire(end, acquiredAt[end] - waitBegin);
+        )
         nodes[end] = ptr;
         end ++;
     }
 
-    template <typename T>
-    bool LockManager<T>::isLocked(FineNode<T> *ptr) {
+    template <typename T, int Order>
+    bool LockManager<T, Order>::isLocked(FineNode<T, Order> *ptr) {
         for (size_t idx = start; idx < end; idx ++) {
             if (nodes[idx] == ptr) return true;
         };
         return false;
     }
 
-    template <typename T>
-    void LockManager<T>::releaseAll() {
+    template <typename T, int Order>
+    void LockManager<T, Order>::releaseAll() {
+        LOCK_PROFILE_DO(
+            uint64_t releaseAt = nowNs();
+            for (size_t idx = start; idx < end; idx ++) {
+                if (nodes[idx] != nullptr) LockProfile::local().onRelease(idx, releaseAt - acquiredAt[idx]);
+            }
+        )
         if (isShared) {
             while (start != end) {
                 if (nodes[start] != nullptr) nodes[start]->latch.unlock_shared();
@@ -32,8 +45,14 @@ namespace Tree {
         }
     }
 
-    template <typename T>
-    void LockManager<T>::releasePrev() {
+    template <typename T, int Order>
+    void LockManager<T, Order>::releasePrev() {
+        LOCK_PROFILE_DO(
+            uint64_t releaseAt = nowNs();
+            for (size_t idx = start; idx + 1 < end; idx ++) {
+                if (nodes[idx] != nullptr) LockProfile::local().onRelease(idx, releaseAt - acquiredAt[idx]);
+            }
+        )
         if (isShared) {
             while ((end - start) > 1) {
                 if (nodes[start] != nullptr) nodes[start]->latch.unlock_shared();
@@ -47,8 +66,8 @@ namespace Tree {
         }
     }
 
-    template <typename T>
-    void LockManager<T>::popAndDelete(FineNode<T> *ptr) {
+    template <typename T, int Order>
+    void LockManager<T, Order>::popAndDelete(FineNode<T, Order> *ptr) {
         for (size_t idx = start; idx < end; idx ++) {
             if (nodes[idx] == ptr) {
                 nodes[idx] = nullptr;
@@ -79,6 +79,7 @@ namespace Tree {
                     // Case 1: worker finds that none of their parents need update
                     // Case 2: background done dealing root
                     nextStage = PalmStage::COLLECT;
+                    complete_batch(scheduler);
                 } else if (isRootUpdate) {
                     DBG_ASSERT(assign_node_to_thread.size() == 1);
                     nextStage = PalmStage::EXEC_ROOT;
@@ -106,6 +107,7 @@ namespace Tree {
                 // DBG_PRINT(std::cout << "BG: EXEC_ROOT" << std::endl;);
                 root_execute(scheduler, scheduler->request_assign[0]);
                 nextStage = PalmStage::COLLECT;
+                complete_batch(scheduler);
                 break;
 
             default:
@@ -119,6 +121,21 @@ namespace Tree {
     }
     
 
+    /** Every request of curr_batch is applied, including the splits and merges it caused. */
+    static void complete_batch(Scheduler *scheduler) {
+        if (scheduler->latency == nullptr) return;
+        uint64_t now = nowNs();
+        for (uint32_t i = 0; i < BATCHSIZE; i++) {
+            const Request &req = scheduler->curr_batch[i];
+            switch (req.op) {
+            case TreeOp::INSERT: scheduler->latency->insert.record(now - req.submitNs); break;
+            case TreeOp::DELETE: scheduler->latency->remove.record(now - req.submitNs); break;
+            case TreeOp::GET:    scheduler->latency->get.record(now - req.submitNs); break;
+            default: break;
+            }
+        }
+    }
+
     static void distribute(
         Scheduler *scheduler, 
         std::unordered_map<FreeNode<T> *, std::vector<uint32_t>> &assign_node_to_thread
@@ -85,4 +85,21 @@ namespace Tree {
     void FreeBPlusTree<T>::get(T key) {
         scheduler_->submit_request({Scheduler<T>::TreeOp::GET, key});
     }
+
+    template <typename T>
+    void FreeBPlusTree<T>::trackLatency(OpLatency *latency) {
+        scheduler_->trackLatency(latency);
+    }
+
+    /** The scheduler (batch buffers and request queues) is charged to otherBytes. */
+    template <typename T>
+    MemoryStats FreeBPlusTree<T>::memoryStats() {
+        MemoryStats stats;
+        stats.maxKeysPerNode = ORDER_ - 1;
+        stats.otherBytes     = sizeof(*this) + sizeof(Scheduler<T>) + containerBytes(rootPtr.children);
+        if (!rootPtr.isLeaf) {
+            for (FreeNode<T> *root : rootPtr.children) collectMemoryStats(root, stats);
+        }
+        return stats;
+    }
 }
@@ -57,9 +57,15 @@ namespace Tree {
         * in the client, we use the while loop below to ensure that no conflict
         * write will occur on the request_queue.
         */
+        if (latency != nullptr) request.submitNs = nowNs();
         while (!request_queue.push(request)) {};
     }
 
+    template <typename T>
+    void Scheduler<T>::trackLatency(OpLatency *latency) {
+        this->latency = latency;
+    }
+
     template <typename T>
     inline bool Scheduler<T>::isTerminate(int &flag) {
         return flag & TERMINATE_FLAG;
@@ -0,0 +1,93 @@
+#pragma once
+#include "../tree.h"
+
+namespace Tree {
+    template <typename T, int Order>
+    SeqBPlusTree<T, Order>::Iterator::Iterator(SeqNode<T, Order> *root, SeqNode<T, Order> *leaf, size_t index):
+        root(root), leaf(leaf), index(index) {
+        skipEmpty();
+    }
+
+    /** Move forward until pointing at a key (or end()), leaves may be empty after removals. */
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::Iterator::skipEmpty() {
+        while (leaf != nullptr && index >= leaf->numKeys()) {
+            leaf  = leaf->next;
+            index = 0;
+        }
+    }
+
+    template <typename T, int Order>
+    T SeqBPlusTree<T, Order>::Iterator::operator*() const {
+        DBG_ASSERT(leaf != nullptr);
+        return leaf->keyAt(index);
+    }
+
+    template <typename T, int Order>
+    typename SeqBPlusTree<T, Order>::Iterator &SeqBPlusTree<T, Order>::Iterator::operator++() {
+        index ++;
+        skipEmpty();
+        return *this;
+    }
+
+    template <typename T, int Order>
+    typename SeqBPlusTree<T, Order>::Iterator SeqBPlusTree<T, Order>::Iterator::operator++(int) {
+        Iterator prev = *this;
+        ++(*this);
+        return prev;
+    }
+
+    template <typename T, int Order>
+    typename SeqBPlusTree<T, Order>::Iterator &SeqBPlusTree<T, Order>::Iterator::operator--() {
+        if (leaf == nullptr) {
+            // Step back from end(), start at the right-most leaf
+            for (leaf = root; !leaf->isLeaf; leaf = leaf->children.back()) {}
+            index = leaf->numKeys();
+        }
+        while (index == 0 && leaf->prev != nullptr) {
+            leaf  = leaf->prev;
+            index = leaf->numKeys();
+        }
+        DBG_ASSERT(index > 0);  // Decrementing begin() is undefined
+        index --;
+        return *this;
+    }
+
+    template <typename T, int Order>
+    typename SeqBPlusTree<T, Order>::Iterator SeqBPlusTree<T, Order>::Iterator::operator--(int) {
+        Iterator prev = *this;
+        --(*this);
+        return prev;
+    }
+
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::Iterator::operator==(const Iterator &other) const {
+        return leaf == other.leaf && (leaf == nullptr || index == other.index);
+    }
+
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::Iterator::operator!=(const Iterator &other) const {
+        return !(*this == other);
+    }
+
+    template <typename T, int Order>
+    typename SeqBPlusTree<T, Order>::Iterator SeqBPlusTree<T, Order>::begin() {
+        SeqNode<T, Order> *ptr = &rootPtr;
+        for (; !ptr->isLeaf; ptr = ptr->children[0]) {}
+        return Iterator(&rootPtr, ptr, 0);
+    }
+
+    template <typename T, int Order>
+    typename SeqBPlusTree<T, Order>::Iterator SeqBPlusTree<T, Order>::end() {
+        return Iterator(&rootPtr, nullptr, 0);
+    }
+
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::forEach(const std::function<void(const T&)> &visitor) {
+        SeqNode<T, Order> *ptr = &rootPtr;
+        for (; !ptr->isLeaf; ptr = ptr->children[0]) {}
+        for (; ptr != nullptr; ptr = ptr->next) {
+            ptr->forEachKey(visitor);
+        }
+    }
+}
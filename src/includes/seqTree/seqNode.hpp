@@ -4,17 +4,17 @@
 #include "../tree.h"
 
 namespace Tree {
-    template <typename T>
-    void SeqNode<T>::releaseAll() {
+    template <typename T, int Order>
+    void SeqNode<T, Order>::releaseAll() {
         if (!isLeaf) {
             for (auto child : children) child->releaseAll();
         }
         delete this;
     }
 
-    template <typename T>
-    bool SeqNode<T>::debug_checkParentPointers() {
-        for (Tree::SeqNode<T>* child : children) {
+    template <typename T, int Order>
+    bool SeqNode<T, Order>::debug_checkParentPointers() {
+        for (Tree::SeqNode<T, Order>* child : children) {
             if (child->parent != this) 
                 return false;
             if (!(child->isLeaf || child->debug_checkParentPointers())) 
@@ -24,20 +24,21 @@ namespace Tree {
         return this->parent->children[childIndex] == this;
     }
     
-    template <typename T>
-    void SeqNode<T>::printKeys() {
+    template <typename T, int Order>
+    void SeqNode<T, Order>::printKeys() {
         std::cout << "[";
         std::cout << childIndex << "|";
         for (int i = 0; i < numKeys(); i ++) {
-            std::cout << keys[i];
+            std::cout << keyAt(i);
             if (i != numKeys() - 1) std::cout << ",";
         }
         std::cout << "]";
     }
 
-    template <typename T>
-    bool SeqNode<T>::debug_checkOrdering(std::optional<T> lower, std::optional<T> upper) {
-        for (const auto key : this->keys) {
+    template <typename T, int Order>
+    bool SeqNode<T, Order>::debug_checkOrdering(std::optional<T> lower, std::optional<T> upper) {
+        for (size_t idx = 0; idx < numKeys(); idx ++) {
+            const T key = keyAt(idx);
             if (lower.has_value() && key < lower.value()) {                
                 std::cout << "\033[1;31m FAILED lower has value:" << lower.value() << " ";
                 this->printKeys();
@@ -82,8 +83,8 @@ namespace Tree {
         return true;
     }
     
-    template <typename T>
-    bool SeqNode<T>::debug_checkChildCnt(int order, bool allowEmpty) {
+    template <typename T, int Order>
+    bool SeqNode<T, Order>::debug_checkChildCnt(int order, bool allowEmpty) {
         if (isLeaf && !allowEmpty) {
             return numChild() == 0 && numKeys() >= ((order-1)/2);
         } else if (isLeaf) {
@@ -100,11 +101,31 @@ namespace Tree {
         return true;
     }
 
-    template <typename T>
-    void SeqNode<T>::consolidateChild() {
+    template <typename T, int Order>
+    void SeqNode<T, Order>::consolidateChild() {
         for (size_t id = 0; id < numChild(); id ++) {
             children[id]->parent = this;
             children[id]->childIndex = id;
         }
     }
+
+    /** Freeze a leaf into the packed format, returns false if packing would not save space. */
+    template <typename T, int Order>
+    bool SeqNode<T, Order>::pack() {
+        if (!isLeaf || isDummy || isPacked()) return false;
+        uint8_t width = LeafCodec<T>::widthFor(keys);
+        if (width == 0) return false;
+        LeafCodec<T>::encode(keys, width);
+        packWidth = width;
+        return true;
+    }
+
+    /** Bring a leaf back to raw keys before it is written, and mark it as hot. */
+    template <typename T, int Order>
+    void SeqNode<T, Order>::thaw() {
+        hot = true;
+        if (!isPacked()) return;
+        LeafCodec<T>::decode(keys, packWidth, Order);
+        packWidth = 0;
+    }
 }
@@ -4,46 +4,50 @@
 #include <cassert>
 #include <optional>
 #include "../tree.h"
+#include "seqIterator.hpp"
 
 namespace Tree {
-    template<typename T>
-    SeqBPlusTree<T>::SeqBPlusTree(int order): ORDER_(order), size_(0), rootPtr(SeqNode<T>(true, true)) {}
+    template <typename T, int Order>
+    SeqBPlusTree<T, Order>::SeqBPlusTree(int order): ORDER_(order), size_(0), rootPtr(SeqNode<T, Order>(true, true)) {
+        assert(Order == 0 || order == Order);
+    }
 
-    template <typename T>
-    SeqNode<T> *SeqBPlusTree<T>::getRoot() {
+    template <typename T, int Order>
+    SeqNode<T, Order> *SeqBPlusTree<T, Order>::getRoot() {
         return &rootPtr;
     }
 
-    template <typename T>
-    int SeqBPlusTree<T>::size() {
+    template <typename T, int Order>
+    int SeqBPlusTree<T, Order>::size() {
         return size_;
     }
 
-    template <typename T>
-    SeqBPlusTree<T>::~SeqBPlusTree() {
+    template <typename T, int Order>
+    SeqBPlusTree<T, Order>::~SeqBPlusTree() {
         if (rootPtr.numChild() != 0) rootPtr.children[0]->releaseAll();
         // delete rootPtr;
     }
 
-    template <typename T>
-    void SeqBPlusTree<T>::insert(T key) {
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::insert(T key) {
         size_ ++;
-        SeqNode<T> *node = findLeafNode(&rootPtr, key);
+        SeqNode<T, Order> *node = findLeafNode(&rootPtr, key);
         if (node == &rootPtr) {
-            SeqNode<T> *root = new SeqNode<T>(true);
+            SeqNode<T, Order> *root = new SeqNode<T, Order>(true);
             insertKey(root, key);
 
             rootPtr.children.push_back(root);
             rootPtr.isLeaf = false;
             rootPtr.consolidateChild();
         } else {
+            node->thaw();
             insertKey(node, key);
-            if (node->numKeys() >= ORDER_) splitNode(node, key);
+            if (node->numKeys() >= order()) splitNode(node, key);
         }
     }
 
-    template <typename T>
-    SeqNode<T>* SeqBPlusTree<T>::findLeafNode(SeqNode<T>* node, T key) {
+    template <typename T, int Order>
+    SeqNode<T, Order>* SeqBPlusTree<T, Order>::findLeafNode(SeqNode<T, Order>* node, T key) {
         DBG_ASSERT(node == &rootPtr);
         while (!node->isLeaf) {
             /** getGTKeyIdx will have index = 0 if node is dummy node */
@@ -53,16 +57,33 @@ namespace Tree {
         return node;
     }
     
-    template <typename T>
-    void SeqBPlusTree<T>::insertKey(SeqNode<T>* node, T key) {
+    /**
+     * Same as findLeafNode, also returns the exclusive upper bound of the keys routed to the leaf
+     * (nullopt for the right-most leaf). Every key in [key, upper) lands in the same leaf.
+     */
+    template <typename T, int Order>
+    SeqNode<T, Order>* SeqBPlusTree<T, Order>::findLeafNodeBounded(T key, std::optional<T> &upper) {
+        SeqNode<T, Order> *node = &rootPtr;
+        upper = std::nullopt;
+        while (!node->isLeaf) {
+            size_t index = node->getGtKeyIdx(key);
+            // Separators deeper in the tree are always tighter than the ones above
+            if (index < node->numKeys()) upper = node->keys[index];
+            node = node->children[index];
+        }
+        return node;
+    }
+
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::insertKey(SeqNode<T, Order>* node, T key) {
         size_t index = node->getGtKeyIdx(key);
         node->keys.insert(node->keys.begin() + index, key);
     }
 
-    template <typename T>
-    void SeqBPlusTree<T>::splitNode(SeqNode<T>* node, T key) {
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::splitNode(SeqNode<T, Order>* node, T key) {
         DBG_ASSERT(node != &rootPtr);
-        SeqNode<T> *new_node = new SeqNode<T>(node->isLeaf);
+        SeqNode<T, Order> *new_node = new SeqNode<T, Order>(node->isLeaf);
         auto middle   = node->numKeys() / 2;
         auto mid_key  = node->keys[middle];
 
@@ -143,7 +164,7 @@ namespace Tree {
              * the left-most and right-most child.
              */
             assert (newNodeOnRight);
-            SeqNode<T> *new_root = new SeqNode<T>(false);
+            SeqNode<T, Order> *new_root = new SeqNode<T, Order>(false);
             new_root->children.push_back(node);
             new_root->children.push_back(new_node);
             
@@ -165,7 +186,7 @@ namespace Tree {
              * register new_node into some parent node and maybe recursively split the 
              * parent if needed.
              */
-            SeqNode<T> *parent = node->parent;
+            SeqNode<T, Order> *parent = node->parent;
             size_t index = node->childIndex;
             
             if (newNodeOnRight) {
@@ -212,17 +233,21 @@ namespace Tree {
             /**
              * If the parent is too full, split the parent node recursively.
              */
-            if (parent->numKeys() >= ORDER_) splitNode(parent, key);
+            if (parent->numKeys() >= order()) splitNode(parent, key);
         }
     }
 
-    template <typename T>
-    std::optional<T> SeqBPlusTree<T>::get(T key) {
-        SeqNode<T> *node = findLeafNode(&rootPtr, key);
+    template <typename T, int Order>
+    std::optional<T> SeqBPlusTree<T, Order>::get(T key) {
+        SeqNode<T, Order> *node = findLeafNode(&rootPtr, key);
         if (node == &rootPtr) {
             return std::nullopt;
         }
         DBG_ASSERT(node != &rootPtr);
+        if (node->isPacked()) {
+            if (node->hasKey(key)) return key;
+            return std::nullopt;
+        }
         auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
         int index = std::distance(node->keys.begin(), it);
 
@@ -232,19 +257,19 @@ namespace Tree {
         return std::nullopt; // Key not found
     }
 
-    template <typename T>
-    bool SeqBPlusTree<T>::isHalfFull(SeqNode<T>* node) {
-        return node->numKeys() >= ((ORDER_ - 1) / 2);
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::isHalfFull(SeqNode<T, Order>* node) {
+        return node->numKeys() >= ((order() - 1) / 2);
     }
 
-    template <typename T>
-    bool SeqBPlusTree<T>::moreHalfFull(SeqNode<T>* node) {
-        return node->numKeys() > ((ORDER_ - 1) / 2);
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::moreHalfFull(SeqNode<T, Order>* node) {
+        return node->numKeys() > ((order() - 1) / 2);
     }
 
-    template <typename T>
-    bool SeqBPlusTree<T>::remove(T key) {
-        SeqNode<T>* node = findLeafNode(&rootPtr, key);
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::remove(T key) {
+        SeqNode<T, Order>* node = findLeafNode(&rootPtr, key);
         /**
          * NOTE: If the tree is empty, then node must be rootPtr
          * and since rootPtr have no key, removeFromLeaf(rootPtr, key)
@@ -256,6 +281,13 @@ namespace Tree {
         
         DBG_ASSERT(node != &rootPtr);
         size_ --;
+        removeFixup(node);
+        return true;
+    }
+
+    /** Restore the tree invariants after keys were removed from leaf node. */
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::removeFixup(SeqNode<T, Order>* node) {
         /** 
          * Case 1: Removing the last element of tree
          * the tree will be empty and rootPtr replaced by nullptr 
@@ -264,7 +296,7 @@ namespace Tree {
             rootPtr.children.clear();
             rootPtr.isLeaf = true;
             delete node; // TODO: check if correct
-            return true;
+            return;
         }
         
         /** 
@@ -274,12 +306,10 @@ namespace Tree {
         if (!isHalfFull(node)) {
             removeBorrow(node);
         }
-        
-        return true;
     }
 
-    template <typename T>
-    void SeqBPlusTree<T>::removeBorrow(SeqNode<T> *node) {
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::removeBorrow(SeqNode<T, Order> *node) {
         // Edge case: root has no sibling node to borrow with
         if (node->parent == &rootPtr) {
             if (node->numKeys() == 0) {
@@ -297,7 +327,7 @@ namespace Tree {
          * For the simplicity and fine grained locking, we always operate the sibling node
          * with same direct parent as current node.
          */
-        // SeqNode<T> *leftNode  = node->prev
+        // SeqNode<T, Order> *leftNode  = node->prev
         //         ,  *rightNode = node->next;
         
         // if (leftNode != nullptr && leftNode->parent == node->parent) {
@@ -307,8 +337,9 @@ namespace Tree {
              * 1. try to borrow from left node (node -> prev)
              * 2. If 1) failed, try to merge with left node (node -> prev)
              */
-            SeqNode<T> *leftNode = node->prev;
+            SeqNode<T, Order> *leftNode = node->prev;
             DBG_ASSERT(leftNode->parent == node->parent);
+            leftNode->thaw();
             if (moreHalfFull(leftNode)) {
                 size_t index = leftNode->childIndex;
                 if (!node->isLeaf) {
@@ -355,8 +386,9 @@ namespace Tree {
              * 1. try to borrow from right node (node -> next)
              * 2. If 1) failed, try to merge with right node (node -> next)
              */
-            SeqNode<T> *rightNode = node->next;
+            SeqNode<T, Order> *rightNode = node->next;
             DBG_ASSERT(rightNode->parent == node->parent);
+            rightNode->thaw();
 
             if (moreHalfFull(rightNode)) {
                 size_t index = node->childIndex;
@@ -403,10 +435,10 @@ namespace Tree {
         }
     }
 
-    template <typename T>
-    void SeqBPlusTree<T>::removeMerge(SeqNode<T>* node) {
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::removeMerge(SeqNode<T, Order>* node) {
         bool leftMergeToRight;
-        SeqNode<T> *leftNode, *rightNode, *parent;
+        SeqNode<T, Order> *leftNode, *rightNode, *parent;
 
         /**
          * NOTE: No need to handle root here since we always first try to borrow
@@ -531,18 +563,24 @@ namespace Tree {
         if (!isHalfFull(parent)) removeBorrow(parent);
     }
     
-    template <typename T>
-    bool SeqBPlusTree<T>::removeFromLeaf(SeqNode<T>* node, T key) {
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::removeFromLeaf(SeqNode<T, Order>* node, T key) {
+        // A miss leaves a packed leaf packed
+        if (node->isPacked()) {
+            if (!node->hasKey(key)) return false;
+            node->thaw();
+        }
         auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
         if (it != node->keys.end() && *it == key) {
             node->keys.erase(it);
+            node->hot = true;
             return true;
         }
         return false;
     }
 
-    template <typename T>
-    bool SeqBPlusTree<T>::debug_checkIsValid(bool verbose) {
+    template <typename T, int Order>
+    bool SeqBPlusTree<T, Order>::debug_checkIsValid(bool verbose) {
         if (!rootPtr.isDummy) return false;
         if (rootPtr.numChild() == 0) return size_ == 0;
         if (rootPtr.numChild() > 1) return false;
@@ -556,15 +594,17 @@ namespace Tree {
         bool isValidOrdering = rootPtr.children[0]->debug_checkOrdering(std::nullopt, std::nullopt);
         if (!isValidOrdering)  return false;
 
-        // checking number of key/children
-        bool isValidChildCnt = rootPtr.children[0]->debug_checkChildCnt(ORDER_);
+        // checking number of key/children, a root leaf may be less than half full
+        SeqNode<T, Order> *root = rootPtr.children[0];
+        bool isValidChildCnt = root->isLeaf ? root->numKeys() < static_cast<size_t>(order())
+                                            : root->debug_checkChildCnt(order());
         if (!isValidChildCnt) return false;
 
-        Tree::SeqNode<T>* src = rootPtr.children[0];
+        Tree::SeqNode<T, Order>* src = rootPtr.children[0];
         do {
             if (src->numChild() == 0) break;
             src = src->children[0];
-            SeqNode<T> *ckptr = src;
+            SeqNode<T, Order> *ckptr = src;
 
             // Check the leaf nodes linked list
             while (ckptr->next != nullptr) {
@@ -576,7 +616,7 @@ namespace Tree {
                     return false;
                 }
 
-                if (ckptr->next->keys[0] < ckptr->keys.back()) {
+                if (ckptr->next->keyAt(0) < ckptr->keyAt(ckptr->numKeys() - 1)) {
                     std::cerr << "Leaves not well-ordered!\nI will try to print the tree to help debugging:" << std::endl;
                     std::cout << "\033[1;31m FAILED";
                     this->print();
@@ -602,18 +642,18 @@ namespace Tree {
         return true;
     }
 
-    template <typename T>
-    void SeqBPlusTree<T>::print() {
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::print() {
         
         std::cout << "[Sequential B+ Tree]" << std::endl;
         if (rootPtr.numChild() == 0) {
             std::cout << "(Empty)" << std::endl;
             return;
         }
-        SeqNode<T>* src = &rootPtr;
+        SeqNode<T, Order>* src = &rootPtr;
         int level_cnt = 0;
         do {
-            SeqNode<T>* ptr = src;
+            SeqNode<T, Order>* ptr = src;
             std::cout << level_cnt << "\t| ";
             while (ptr != nullptr) {
                 ptr->printKeys();
@@ -629,18 +669,127 @@ namespace Tree {
         std::cout << std::endl;
     }
 
-    template <typename T>
-    std::vector<T> SeqBPlusTree<T>::toVec() {
-        SeqNode<T> *ptr = &rootPtr;
+    template <typename T, int Order>
+    std::vector<T> SeqBPlusTree<T, Order>::toVec() {
+        SeqNode<T, Order> *ptr = &rootPtr;
         std::vector<T> vec;
         if (ptr == nullptr) return vec;
         
         for (; !ptr->isLeaf; ptr = ptr->children[0]){}
         while (ptr != nullptr) {
-            for (T &key : ptr->keys) vec.push_back(key);
+            ptr->forEachKey([&vec](T key) { vec.push_back(key); });
             ptr = ptr->next;
         }
         return vec;
     }
-};
 
+    template <typename T, int Order>
+    size_t SeqBPlusTree<T, Order>::compactLeaves(double minFill, bool coldOnly) {
+        SeqNode<T, Order> *ptr = &rootPtr;
+        for (; !ptr->isLeaf; ptr = ptr->children[0]) {}
+
+        const size_t minKeys = static_cast<size_t>(minFill * (order() - 1));
+        size_t packed = 0;
+        for (; ptr != nullptr; ptr = ptr->next) {
+            bool cold = !(coldOnly && ptr->hot);
+            ptr->hot  = false;
+            if (cold && ptr->numKeys() >= minKeys && ptr->pack()) packed ++;
+        }
+        return packed;
+    }
+
+    /** The dummy root lives inside the tree object, it is charged with it to otherBytes. */
+    template <typename T, int Order>
+    MemoryStats SeqBPlusTree<T, Order>::memoryStats() {
+        MemoryStats stats;
+        stats.maxKeysPerNode = order() - 1;
+        stats.otherBytes     = sizeof(*this) + containerBytes(rootPtr.children);
+        for (SeqNode<T, Order> *root : rootPtr.children) collectMemoryStats(root, stats);
+        return stats;
+    }
+
+    /**
+     * Merge a sorted run into the leaves. Every descent serves all keys of the run that belong
+     * to the leaf found, up to the number of keys that leaf can take before one split, so each
+     * leaf is merged and split at most once per descent.
+     */
+    template <typename T, int Order>
+    void SeqBPlusTree<T, Order>::insertSorted(const std::vector<T> &keys) {
+        DBG_ASSERT(std::is_sorted(keys.begin(), keys.end()));
+        size_t idx = 0;
+        if (idx < keys.size() && rootPtr.isLeaf) insert(keys[idx ++]);
+
+        std::optional<T> upper;
+        while (idx < keys.size()) {
+            SeqNode<T, Order> *node = findLeafNodeBounded(keys[idx], upper);
+            node->thaw();
+
+            size_t room = order() - node->numKeys();
+            size_t last = idx + 1;
+            while (last < keys.size() && last - idx < room && (!upper.has_value() || keys[last] < upper.value())) last ++;
+
+            size_t oldSize = node->numKeys();
+            node->keys.insert(node->keys.end(), keys.begin() + idx, keys.begin() + last);
+            std::inplace_merge(node->keys.begin(), node->keys.begin() + oldSize, node->keys.end());
+            size_ += last - idx;
+
+            if (node->numKeys() >= order()) splitNode(node, keys[idx]);
+            idx = last;
+        }
+    }
+
+    /**
+     * Remove a sorted run from the leaves. Every descent removes the keys of the run that belong
+     * to the leaf found, but never takes it more than one key below half full, so a single
+     * borrow or merge restores it.
+     */
+    template <typename T, int Order>
+    size_t SeqBPlusTree<T, Order>::eraseSorted(const std::vector<T> &keys) {
+        DBG_ASSERT(std::is_sorted(keys.begin(), keys.end()));
+        size_t idx = 0, removed = 0;
+        std::optional<T> upper;
+        while (idx < keys.size()) {
+            if (rootPtr.isLeaf) break;     // Tree is empty, nothing left to remove
+            SeqNode<T, Order> *node = findLeafNodeBounded(keys[idx], upper);
+
+            size_t last = idx;
+            while (last < keys.size() && (!upper.has_value() || keys[last] < upper.value())) last ++;
+            if (node->isPacked()) {
+                bool anyHit = false;
+                for (size_t probe = idx; probe < last && !anyHit; probe ++) anyHit = node->hasKey(keys[probe]);
+                if (!anyHit) {
+                    idx = last;
+                    continue;
+                }
+            }
+            node->thaw();
+
+            // Merge-walk the leaf and the run, dropping one leaf key per matching run key
+            const size_t minKeys = (order() - 1) / 2;
+            const size_t budget  = node->parent == &rootPtr ? std::max<size_t>(node->numKeys(), 1) : node->numKeys() - minKeys + 1;
+            size_t write = 0, erased = 0;
+            std::vector<T> &leafKeys = node->keys;
+            for (size_t read = 0; read < leafKeys.size(); read ++) {
+                if (erased < budget) {
+                    while (idx < last && keys[idx] < leafKeys[read]) idx ++;
+                    if (idx < last && keys[idx] == leafKeys[read]) {
+                        idx ++;
+                        erased ++;
+                        continue;
+                    }
+                }
+                leafKeys[write ++] = leafKeys[read];
+            }
+            leafKeys.resize(write);
+            // Run keys beyond the leaf's largest key are misses, unless the budget cut the walk
+            if (erased < budget) idx = last;
+
+            if (erased == 0) continue;
+            node->hot = true;
+            size_   -= erased;
+            removed += erased;
+            removeFixup(node);
+        }
+        return removed;
+    }
+};
@@ -0,0 +1,323 @@
+#pragma once
+#include <limits>
+#include <optional>
+#include <shared_mutex>
+#include "tree.h"
+
+/**
+ * @brief Range-partitioned front-end over independent inner trees
+ *
+ * The key domain is cut into numShards contiguous ranges, each served by its own Inner<T>.
+ * Operations on different shards never touch a common node, so there is no global root to
+ * contend on. Every operation holds the routing table (bounds) in shared mode, which is a
+ * sharded BRLock and therefore cheap; an inner tree that is not concurrent on its own is
+ * additionally protected by its shard's lock.
+ *
+ * Every shard counts the operations it serves. When a shard becomes much hotter than the
+ * average, half of its keys are moved to its colder neighbour and the boundary between the
+ * two is moved accordingly (with the routing table held exclusively).
+ */
+
+namespace Tree {
+    template <typename T, template <typename> class Inner>
+    ShardedTree<T, Inner>::ShardedTree(int order, int numShards):
+        ShardedTree(order, numShards, std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max()) {}
+
+    template <typename T, template <typename> class Inner>
+    ShardedTree<T, Inner>::ShardedTree(int order, int numShards, T keyLow, T keyHigh): ORDER_(order) {
+        assert(numShards >= 1);
+        for (int idx = 0; idx < numShards; idx ++) shards.emplace_back(new Shard(order));
+
+        long double span = static_cast<long double>(keyHigh) - static_cast<long double>(keyLow);
+        for (int idx = 1; idx < numShards; idx ++) {
+            bounds.push_back(static_cast<T>(keyLow + span * idx / numShards));
+        }
+    }
+
+    template <typename T, template <typename> class Inner>
+    ShardedTree<T, Inner>::~ShardedTree() {}
+
+    template <typename T, template <typename> class Inner>
+    size_t ShardedTree<T, Inner>::shardOf(T key) const {
+        return std::distance(bounds.begin(), std::upper_bound(bounds.begin(), bounds.end(), key));
+    }
+
+    template <typename T, template <typename> class Inner>
+    template <bool Write, typename Fn>
+    auto ShardedTree<T, Inner>::route(T key, Fn &&fn) {
+        size_t idx;
+        decltype(fn(std::declval<Inner<T>&>())) result;
+        {
+            std::shared_lock<BRLock> routeGuard(routeLock);
+            idx = shardOf(key);
+            Shard &shard = *shards[idx];
+            if constexpr (IsConcurrentTree<Inner>::value) {
+                result = fn(shard.tree);
+            } else if constexpr (Write) {
+                std::lock_guard<BRLock> guard(shard.lock);
+                result = fn(shard.tree);
+            } else {
+                std::shared_lock<BRLock> guard(shard.lock);
+                result = fn(shard.tree);
+            }
+        }
+        if ((shards[idx]->ops.fetch_add(1, std::memory_order_relaxed) + 1) % ShardRebalanceCheck == 0) {
+            maybeRebalance(idx);
+        }
+        return result;
+    }
+
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::maybeRebalance(size_t hot) {
+        if (shards.size() < 2) return;
+        // Someone else is already repartitioning, the counters will be re-checked later
+        std::unique_lock<std::mutex> guard(rebalanceLock, std::try_to_lock);
+        if (!guard.owns_lock()) return;
+
+        uint64_t total = 0;
+        for (auto &shard : shards) total += shard->ops.load(std::memory_order_relaxed);
+        uint64_t hotOps = shards[hot]->ops.load(std::memory_order_relaxed);
+        if (hotOps * shards.size() <= ShardRebalanceFactor * total) return;
+
+        size_t to;
+        if (hot == 0) to = 1;
+        else if (hot == shards.size() - 1) to = hot - 1;
+        else {
+            uint64_t leftOps  = shards[hot - 1]->ops.load(std::memory_order_relaxed);
+            uint64_t rightOps = shards[hot + 1]->ops.load(std::memory_order_relaxed);
+            to = leftOps <= rightOps ? hot - 1 : hot + 1;
+        }
+
+        {
+            std::lock_guard<BRLock> routeGuard(routeLock);
+            moveRange(hot, to);
+        }
+        // Decay the counters so the new layout is judged mostly by new traffic
+        for (auto &shard : shards) {
+            shard->ops.store(shard->ops.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+        }
+        rebalances ++;
+    }
+
+    /**
+     * Move the half of shard `from` that is adjacent to shard `to` into `to`.
+     * NOTE: Must hold routeLock exclusively, so no operation is in flight on any shard.
+     */
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::moveRange(size_t from, size_t to) {
+        DBG_ASSERT(from + 1 == to || to + 1 == from);
+        std::vector<T> keys = shards[from]->tree.toVec();
+        if (keys.size() < 2) return;
+
+        size_t middle = keys.size() / 2;
+        T splitKey    = keys[middle];
+        std::vector<T> moved = to > from ? std::vector<T>(keys.begin() + middle, keys.end())
+                                         : std::vector<T>(keys.begin(), keys.begin() + middle);
+        shards[from]->tree.eraseSorted(moved);
+        shards[to]->tree.insertSorted(moved);
+        bounds[std::min(from, to)] = splitKey;
+    }
+
+    template <typename T, template <typename> class Inner>
+    std::optional<T> ShardedTree<T, Inner>::get(T key) {
+        return route<false>(key, [key](Inner<T> &tree) { return tree.get(key); });
+    }
+
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::insert(T key) {
+        route<true>(key, [key](Inner<T> &tree) { tree.insert(key); return true; });
+    }
+
+    template <typename T, template <typename> class Inner>
+    bool ShardedTree<T, Inner>::remove(T key) {
+        return route<true>(key, [key](Inner<T> &tree) { return tree.remove(key); });
+    }
+
+    /**
+     * Cut the run at the shard boundaries and hand every piece to its shard in one call. The
+     * routing table is held shared for the whole run, so the boundaries cannot move under it.
+     */
+    template <typename T, template <typename> class Inner>
+    template <typename Fn>
+    void ShardedTree<T, Inner>::routeSorted(const std::vector<T> &keys, Fn &&fn) {
+        DBG_ASSERT(std::is_sorted(keys.begin(), keys.end()));
+        std::vector<std::pair<size_t, uint64_t>> served;
+        {
+            std::shared_lock<BRLock> routeGuard(routeLock);
+            auto first = keys.begin();
+            while (first != keys.end()) {
+                size_t idx = shardOf(*first);
+                auto last  = idx == bounds.size() ? keys.end() : std::lower_bound(first, keys.end(), bounds[idx]);
+                std::vector<T> piece(first, last);
+                Shard &shard = *shards[idx];
+                if constexpr (IsConcurrentTree<Inner>::value) {
+                    fn(shard.tree, piece);
+                } else {
+                    std::lock_guard<BRLock> guard(shard.lock);
+                    fn(shard.tree, piece);
+                }
+                served.emplace_back(idx, piece.size());
+                first = last;
+            }
+        }
+        for (auto [idx, count] : served) {
+            uint64_t before = shards[idx]->ops.fetch_add(count, std::memory_order_relaxed);
+            if (before / ShardRebalanceCheck != (before + count) / ShardRebalanceCheck) maybeRebalance(idx);
+        }
+    }
+
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::insertSorted(const std::vector<T> &keys) {
+        routeSorted(keys, [](Inner<T> &tree, const std::vector<T> &piece) { tree.insertSorted(piece); });
+    }
+
+    template <typename T, template <typename> class Inner>
+    size_t ShardedTree<T, Inner>::eraseSorted(const std::vector<T> &keys) {
+        size_t removed = 0;
+        routeSorted(keys, [&removed](Inner<T> &tree, const std::vector<T> &piece) { removed += tree.eraseSorted(piece); });
+        return removed;
+    }
+
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::print() {
+        std::cout << "[Sharded x" << shards.size() << "] " << std::endl;
+        std::lock_guard<BRLock> routeGuard(routeLock);
+        for (size_t idx = 0; idx < shards.size(); idx ++) {
+            std::cout << "Shard " << idx << " [";
+            if (idx == 0) std::cout << "-inf"; else std::cout << bounds[idx - 1];
+            std::cout << ", ";
+            if (idx == bounds.size()) std::cout << "+inf"; else std::cout << bounds[idx];
+            std::cout << ")" << std::endl;
+            shards[idx]->tree.print();
+        }
+    }
+
+    /** Holds the routing table shared, so a rebalance cannot move keys between the shards counted. */
+    template <typename T, template <typename> class Inner>
+    int ShardedTree<T, Inner>::size() {
+        std::shared_lock<BRLock> routeGuard(routeLock);
+        int size = 0;
+        for (auto &shard : shards) {
+            if constexpr (IsConcurrentTree<Inner>::value) {
+                size += shard->tree.size();
+            } else {
+                std::shared_lock<BRLock> guard(shard->lock);
+                size += shard->tree.size();
+            }
+        }
+        return size;
+    }
+
+    template <typename T, template <typename> class Inner>
+    bool ShardedTree<T, Inner>::debug_checkIsValid(bool verbose) {
+        std::lock_guard<BRLock> routeGuard(routeLock);
+        for (size_t idx = 0; idx < shards.size(); idx ++) {
+            if (!shards[idx]->tree.debug_checkIsValid(verbose)) return false;
+            bool placed = true;
+            shards[idx]->tree.forEach([&](const T &key) {
+                if (shardOf(key) == idx) return;
+                if (verbose) std::cout << "Key " << key << " is misplaced in shard " << idx << std::endl;
+                placed = false;
+            });
+            if (!placed) return false;
+        }
+        return true;
+    }
+
+    template <typename T, template <typename> class Inner>
+    std::vector<T> ShardedTree<T, Inner>::toVec() {
+        std::vector<T> result;
+        forEach([&result](const T &key) { result.push_back(key); });
+        return result;
+    }
+
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::forEach(const std::function<void(const T&)> &visitor) {
+        std::shared_lock<BRLock> routeGuard(routeLock);
+        // Shards cover increasing key ranges, so visiting them in turn is already sorted
+        for (auto &shard : shards) {
+            if constexpr (IsConcurrentTree<Inner>::value) {
+                shard->tree.forEach(visitor);
+            } else {
+                std::shared_lock<BRLock> guard(shard->lock);
+                shard->tree.forEach(visitor);
+            }
+        }
+    }
+
+    template <typename T, template <typename> class Inner>
+    MemoryStats ShardedTree<T, Inner>::memoryStats() {
+        std::shared_lock<BRLock> routeGuard(routeLock);
+        MemoryStats stats;
+        stats.otherBytes = sizeof(*this) + containerBytes(shards) + containerBytes(bounds);
+        for (auto &shard : shards) {
+            MemoryStats inner;
+            if constexpr (IsConcurrentTree<Inner>::value) {
+                inner = shard->tree.memoryStats();
+            } else {
+                std::shared_lock<BRLock> guard(shard->lock);
+                inner = shard->tree.memoryStats();
+            }
+            // The inner tree object is part of the shard, it is already in inner.otherBytes
+            inner.otherBytes += sizeof(Shard) - sizeof(shard->tree);
+            stats.merge(inner);
+        }
+        return stats;
+    }
+
+    template <typename T, template <typename> class Inner>
+    ShardedTree<T, Inner>::Iterator::Iterator(ShardedTree *tree, size_t shard, typename Inner<T>::Iterator it):
+        tree(tree), shard(shard), it(std::move(it)) {
+        skipEmpty();
+    }
+
+    template <typename T, template <typename> class Inner>
+    void ShardedTree<T, Inner>::Iterator::skipEmpty() {
+        while (shard + 1 < tree->shards.size() && it == tree->shards[shard]->tree.end()) {
+            shard ++;
+            it = tree->shards[shard]->tree.begin();
+        }
+    }
+
+    template <typename T, template <typename> class Inner>
+    T ShardedTree<T, Inner>::Iterator::operator*() const {
+        return *it;
+    }
+
+    template <typename T, template <typename> class Inner>
+    typename ShardedTree<T, Inner>::Iterator &ShardedTree<T, Inner>::Iterator::operator++() {
+        ++it;
+        skipEmpty();
+        return *this;
+    }
+
+    template <typename T, template <typename> class Inner>
+    bool ShardedTree<T, Inner>::Iterator::operator==(const Iterator &other) const {
+        return shard == other.shard && it == other.it;
+    }
+
+    template <typename T, template <typename> class Inner>
+    bool ShardedTree<T, Inner>::Iterator::operator!=(const Iterator &other) const {
+        return !(*this == other);
+    }
+
+    template <typename T, template <typename> class Inner>
+    typename ShardedTree<T, Inner>::Iterator ShardedTree<T, Inner>::begin() {
+        return Iterator(this, 0, shards[0]->tree.begin());
+    }
+
+    template <typename T, template <typename> class Inner>
+    typename ShardedTree<T, Inner>::Iterator ShardedTree<T, Inner>::end() {
+        return Iterator(this, shards.size() - 1, shards.back()->tree.end());
+    }
+
+    template <typename T, template <typename> class Inner>
+    int ShardedTree<T, Inner>::numShards() const {
+        return static_cast<int>(shards.size());
+    }
+
+    template <typename T, template <typename> class Inner>
+    uint64_t ShardedTree<T, Inner>::numRebalances() const {
+        return rebalances.load();
+    }
+}
@@ -4,16 +4,27 @@
 #include <algorithm>
 #include <deque>
 #include <mutex>
+#include <thread>
 #include <atomic>
 #include <shared_mutex>
 #include <memory>
 #include <optional>
+#include <limits>
+#include <vector>
+#include <iterator>
+#include <functional>
+#include <type_traits>
 #include <cassert>
 #include <boost/lockfree/queue.hpp>
 #include <boost/lockfree/spsc_queue.hpp>
 
 #include "utility/Sync.h"
 #include "utility/SIMDOptimizer.h"
+#include "utility/LeafCodec.h"
+#include "utility/MemoryStats.h"
+#include "utility/LockProfiler.h"
+#include "utility/Histogram.h"
+#include "utility/timing.h"
 
 
 #ifdef DEBUG
@@ -53,32 +64,68 @@ namespace Tree {
         virtual void print() = 0;
         virtual std::optional<T> get(T key) = 0;
         virtual std::vector<T> toVec() = 0;
+        /** Visit every key in increasing order without materializing them. */
+        virtual void forEach(const std::function<void(const T&)> &visitor) = 0;
+        /** Node counts per level, key slot usage and bytes held by the tree (see MemoryStats). */
+        virtual MemoryStats memoryStats() = 0;
+
+        /**
+         * Batch operations on a sorted run of keys. The defaults apply the run one key at a
+         * time, trees that can merge a run into their leaves in one pass override them.
+         */
+        virtual void insertSorted(const std::vector<T> &keys) {
+            for (const T &key : keys) insert(key);
+        }
+        /** Returns the number of keys actually removed. */
+        virtual size_t eraseSorted(const std::vector<T> &keys) {
+            size_t removed = 0;
+            for (const T &key : keys) removed += remove(key);
+            return removed;
+        }
     };
 
-    template <typename T>
     /**
      * NOTE: A tree node for sequential version of B+ tree
      */
+    template <typename T, int Order = 0>
     struct SeqNode {
         bool isLeaf;                       // Check if node is leaf node
         bool isDummy;                      // Check if node is dummy node
+        uint8_t packWidth = 0;             // Delta width of a packed (frozen) leaf, 0 if keys are raw
+        bool hot = false;                  // Leaf was written since the last compaction
         int  childIndex;                   // Which child am I in parent? (-1 if no parent)
-        std::vector<T> keys;               // Keys
-        std::deque<SeqNode<T>*> children;  // Children
-        SeqNode<T>* parent;                // Pointer to parent node
-        SeqNode<T>* next;                  // Pointer to left sibling
-        SeqNode<T>* prev;                  // Pointer to right sibling
-
-        explicit SeqNode(bool leaf, bool dummy=false) : isLeaf(leaf), isDummy(dummy), parent(nullptr), next(nullptr), prev(nullptr), childIndex(-1) {};
+        std::vector<T> keys;                      // Keys
+        std::deque<SeqNode<T, Order>*> children;  // Children
+        SeqNode<T, Order>* parent;                // Pointer to parent node
+        SeqNode<T, Order>* next;                  // Pointer to left sibling
+        SeqNode<T, Order>* prev;                  // Pointer to right sibling
+
+        explicit SeqNode(bool leaf, bool dummy=false) : isLeaf(leaf), isDummy(dummy), parent(nullptr), next(nullptr), prev(nullptr), childIndex(-1) {
+            // A node holds at most Order keys (right before it splits), allocate them once
+            if constexpr (Order > 0) keys.reserve(Order);
+        };
         void printKeys();
         void releaseAll();
         void consolidateChild();
         bool debug_checkParentPointers();
         bool debug_checkOrdering(std::optional<T> lower, std::optional<T> upper);
         bool debug_checkChildCnt(int ordering, bool allowEmpty=false);
+        bool pack();
+        void thaw();
 
-        inline size_t numKeys()  {return keys.size();}
+        inline bool   isPacked() const {return packWidth != 0;}
+        inline size_t numKeys()  {return isPacked() ? LeafCodec<T>::size(keys) : keys.size();}
         inline size_t numChild() {return children.size();}
+        inline T      keyAt(size_t idx) {return isPacked() ? LeafCodec<T>::at(keys, packWidth, idx) : keys[idx];}
+        inline bool   hasKey(T key) {
+            size_t index = getGtKeyIdx(key);
+            return index > 0 && keyAt(index - 1) == key;
+        }
+        template <typename Fn>
+        inline void forEachKey(Fn &&fn) {
+            if (isPacked()) LeafCodec<T>::forEach(keys, packWidth, fn);
+            else for (const T &key : keys) fn(key);
+        }
         /**
          * Return the index of first key that is greater than or equal to "key".
          * 
@@ -87,9 +134,14 @@ namespace Tree {
          * **out-of-bound** index!
          */
         inline size_t getGtKeyIdx(T key) {
-            size_t index = 0;
-            while (index < numKeys() && keys[index] <= key) index ++;
-            return index;
+            if (isPacked()) return LeafCodec<T>::upperBound(keys, packWidth, key);
+            if constexpr (Order > 0) {
+                return SIMDOptimizer<T>::template getGtKeyIdxBounded<Order>(keys, key);
+            } else {
+                size_t index = 0;
+                while (index < numKeys() && keys[index] <= key) index ++;
+                return index;
+            }
         }
     };
 
@@ -187,6 +239,7 @@ namespace Tree {
             std::optional<T> key;
             int              idx = -1;
             FreeNode<T>       *curr_node = nullptr;
+            uint64_t         submitNs = 0;      // Only stamped while latency is tracked
 
             void print() {
                 if (key.has_value()) std::cout << toString(op) << ", " << key.value() << " at " << idx;
@@ -228,6 +281,8 @@ namespace Tree {
         // This barrier synchronize the worker and background thread
         Barrier syncBarrierA;
         Barrier syncBarrierB;
+        // Submit-to-completion latency, recorded by the background thread as each batch completes
+        OpLatency *latency = nullptr;
 
         struct PrivateWorker;
         struct PrivateBackground;
@@ -235,6 +290,7 @@ namespace Tree {
         Scheduler(int numWorker, FreeNode<T> *rootPtr, int order);
         void waitToExit();
         void submit_request(Request request);
+        void trackLatency(OpLatency *latency);
         void debugPrint();
     private:
         static inline bool isTerminate(int &flag);
@@ -252,6 +308,13 @@ namespace Tree {
         void insert(T key);
         void remove(T key);
         void get(T key);
+        /** NOTE: Only call it while no batch is in flight. */
+        MemoryStats memoryStats();
+        /**
+         * Record how long each request takes from submit until its batch completes into latency,
+         * which must outlive the tree. NOTE: Call it before submitting any request.
+         */
+        void trackLatency(OpLatency *latency);
 
     private:
         Scheduler<T> *scheduler_;
@@ -263,20 +326,24 @@ namespace Tree {
     /**
      * NOTE: A tree node for finegrained locked version of B+ tree
      */
-    template <typename T>
+    template <typename T, int Order = 0>
     struct FineNode {
         std::shared_mutex latch;
 
         bool isLeaf;                        // Check if node is leaf node
         bool isDummy;                       // Check if node is dummy node
+        uint8_t packWidth = 0;              // Delta width of a packed (frozen) leaf, 0 if keys are raw
+        bool hot = false;                   // Leaf was written since the last compaction
         int childIndex;                     // Which child am I in parent? (-1 if no parent)
-        std::vector<T> keys;                // Keys
-        std::deque<FineNode<T>*> children;  // Children
-        FineNode<T>* parent;                // Pointer to parent node
-        FineNode<T>* next;                  // Pointer to left sibling
-        FineNode<T>* prev;                  // Pointer to right sibling
-
-        explicit FineNode(bool leaf, bool dummy=false) : isLeaf(leaf), isDummy(dummy), parent(nullptr), next(nullptr), prev(nullptr), childIndex(-1) {};
+        std::vector<T> keys;                       // Keys
+        std::deque<FineNode<T, Order>*> children;  // Children
+        FineNode<T, Order>* parent;                // Pointer to parent node
+        FineNode<T, Order>* next;                  // Pointer to left sibling
+        FineNode<T, Order>* prev;                  // Pointer to right sibling
+
+        explicit FineNode(bool leaf, bool dummy=false) : isLeaf(leaf), isDummy(dummy), parent(nullptr), next(nullptr), prev(nullptr), childIndex(-1) {
+            if constexpr (Order > 0) keys.reserve(Order);
+        };
 
         void printKeys();
         void releaseAll();
@@ -284,27 +351,48 @@ namespace Tree {
         bool debug_checkParentPointers();
         bool debug_checkOrdering(std::optional<T> lower, std::optional<T> upper);
         bool debug_checkChildCnt(int ordering);
+        bool pack();
+        void thaw();
 
-        inline size_t numKeys()  {return keys.size();}
+        inline bool   isPacked() const {return packWidth != 0;}
+        inline size_t numKeys()  {return isPacked() ? LeafCodec<T>::size(keys) : keys.size();}
         inline size_t numChild() {return children.size();}
+        inline T      keyAt(size_t idx) {return isPacked() ? LeafCodec<T>::at(keys, packWidth, idx) : keys[idx];}
+        inline bool   hasKey(T key) {
+            size_t index = getGtKeyIdx(key);
+            return index > 0 && keyAt(index - 1) == key;
+        }
+        template <typename Fn>
+        inline void forEachKey(Fn &&fn) {
+            if (isPacked()) LeafCodec<T>::forEach(keys, packWidth, fn);
+            else for (const T &key : keys) fn(key);
+        }
         inline size_t getGtKeyIdx(T key) {
-            return SIMDOptimizer<T>::getGtKeyIdxSpecialized(keys, key);
+            if (isPacked()) return LeafCodec<T>::upperBound(keys, packWidth, key);
+            if constexpr (Order > 0) return SIMDOptimizer<T>::template getGtKeyIdxBounded<Order>(keys, key);
+            else                     return SIMDOptimizer<T>::getGtKeyIdxSpecialized(keys, key);
         }
     };
 
-    template<typename T>
+    template <typename T, int Order = 0>
     class SeqBPlusTree : public ITree<T> {
         private:
-            SeqNode<T> rootPtr;
+            SeqNode<T, Order> rootPtr;
             int ORDER_;
             int size_;
 
+            /** With Order > 0 the order (and every threshold derived from it) is a compile-time constant. */
+            inline int order() const {
+                if constexpr (Order > 0) return Order;
+                else                     return ORDER_;
+            }
+
         public:
-            explicit SeqBPlusTree(int order = 3);
+            explicit SeqBPlusTree(int order = Order > 0 ? Order : 3);
             ~SeqBPlusTree();
 
             // Getter
-            SeqNode<T>* getRoot();
+            SeqNode<T, Order>* getRoot();
             bool debug_checkIsValid(bool verbose);
             int  size();
 
@@ -314,25 +402,65 @@ namespace Tree {
             void print();
             std::optional<T> get(T key);
             std::vector<T> toVec();
+            void forEach(const std::function<void(const T&)> &visitor);
+            MemoryStats memoryStats();
+            void insertSorted(const std::vector<T> &keys);
+            size_t eraseSorted(const std::vector<T> &keys);
+
+            /**
+             * Pack every leaf holding at least minFill * (order - 1) keys into the compressed
+             * format (see LeafCodec), skipping leaves written since the last compaction if coldOnly.
+             * Writes transparently thaw a packed leaf. Returns the number of leaves packed.
+             */
+            size_t compactLeaves(double minFill = 0.5, bool coldOnly = true);
+
+            /** Bidirectional iterator over the leaf linked list, invalidated by any write. */
+            class Iterator {
+                public:
+                    using iterator_category = std::bidirectional_iterator_tag;
+                    using value_type        = T;
+                    using difference_type   = std::ptrdiff_t;
+                    using pointer           = void;
+                    using reference         = T;        // Keys of a packed leaf only exist decoded
+
+                    explicit Iterator(SeqNode<T, Order> *root = nullptr, SeqNode<T, Order> *leaf = nullptr, size_t index = 0);
+                    reference operator*() const;
+                    Iterator &operator++();
+                    Iterator  operator++(int);
+                    Iterator &operator--();
+                    Iterator  operator--(int);
+                    bool operator==(const Iterator &other) const;
+                    bool operator!=(const Iterator &other) const;
+
+                private:
+                    SeqNode<T, Order> *root;   // Dummy root, needed to step back from end()
+                    SeqNode<T, Order> *leaf;   // nullptr for end()
+                    size_t index;
+                    void skipEmpty();
+            };
+            Iterator begin();
+            Iterator end();
 
         private:
             // Private helper functions
-            SeqNode<T>* findLeafNode(SeqNode<T>* node, T key);
-            void splitNode(SeqNode<T>* node, T key);
-            void insertKey(SeqNode<T>* node, T key);
-            bool removeFromLeaf(SeqNode<T>* node, T key);
-
-            bool isHalfFull(SeqNode<T>* node);
-            bool moreHalfFull(SeqNode<T>* node);
-
-            void removeBorrow(SeqNode<T>* node);
-            void removeMerge(SeqNode<T>* node);
+            SeqNode<T, Order>* findLeafNode(SeqNode<T, Order>* node, T key);
+            SeqNode<T, Order>* findLeafNodeBounded(T key, std::optional<T> &upper);
+            void splitNode(SeqNode<T, Order>* node, T key);
+            void insertKey(SeqNode<T, Order>* node, T key);
+            bool removeFromLeaf(SeqNode<T, Order>* node, T key);
+
+            bool isHalfFull(SeqNode<T, Order>* node);
+            bool moreHalfFull(SeqNode<T, Order>* node);
+
+            void removeBorrow(SeqNode<T, Order>* node);
+            void removeMerge(SeqNode<T, Order>* node);
+            void removeFixup(SeqNode<T, Order>* node);
     };
 
     template<typename T>
     class CoarseLockBPlusTree : public ITree<T> {
         private:
-            std::mutex lock;
+            BRLock lock;    // get / toVec / print run under the shared side
             SeqBPlusTree<T> tree;
         public:
             explicit CoarseLockBPlusTree(int order = 3);
@@ -345,6 +473,187 @@ namespace Tree {
             void print();
             std::optional<T> get(T key);
             std::vector<T> toVec();
+            void forEach(const std::function<void(const T&)> &visitor);
+            MemoryStats memoryStats();
+            void insertSorted(const std::vector<T> &keys);
+            size_t eraseSorted(const std::vector<T> &keys);
+
+            /** NOTE: Iterators do not take the lock, only use them while no thread is writing. */
+            using Iterator = typename SeqBPlusTree<T>::Iterator;
+            Iterator begin();
+            Iterator end();
+    };
+
+    /**
+     * NOTE: A flat-combining tree can serve at most CombineMaxSlots threads through the
+     * combiner, further threads fall back to taking the lock themselves.
+     */
+    constexpr size_t CombineMaxSlots = 64;
+    constexpr int    CombinePasses   = 3;
+
+    template<typename T>
+    class CombineBPlusTree : public ITree<T> {
+        private:
+            enum CombineOp {INSERT, REMOVE, GET};
+            enum SlotState {IDLE, PENDING, DONE};
+
+            /** One publication slot per thread, padded to its own cache line. */
+            struct alignas(64) Slot {
+                std::atomic<int> state{SlotState::IDLE};
+                std::atomic<std::thread::id> owner{};
+                CombineOp        op;
+                T                key;
+                std::optional<T> result;
+                bool             removed;
+            };
+
+            static std::atomic<uint64_t> nextTreeId;
+
+            std::mutex lock;
+            SeqBPlusTree<T> tree;
+            Slot slots[CombineMaxSlots];
+            std::atomic<size_t> numSlots{0};
+            std::vector<Slot*> pending;     // Scratch buffer of the current combiner
+            uint64_t treeId;
+
+        public:
+            explicit CombineBPlusTree(int order = 3);
+            ~CombineBPlusTree();
+            bool debug_checkIsValid(bool verbose);
+            int  size();
+
+            void insert(T key);
+            bool remove(T key);
+            void print();
+            std::optional<T> get(T key);
+            std::vector<T> toVec();
+            void forEach(const std::function<void(const T&)> &visitor);
+            MemoryStats memoryStats();
+            void insertSorted(const std::vector<T> &keys);
+            size_t eraseSorted(const std::vector<T> &keys);
+
+            /** NOTE: Iterators do not take the lock, only use them while no thread is writing. */
+            using Iterator = typename SeqBPlusTree<T>::Iterator;
+            Iterator begin();
+            Iterator end();
+
+        private:
+            Slot *acquireSlot();
+            Slot *submit(CombineOp op, T key);
+            void combine();
+            void apply(Slot *slot);
+    };
+
+    /**
+     * NOTE: A node of the copy-on-write tree. Nodes are shared between versions, so they carry no
+     * parent / sibling pointers and are never modified once published.
+     */
+    template <typename T>
+    struct CowNode {
+        bool isLeaf;                                            // Check if node is leaf node
+        std::vector<T> keys;                                    // Keys
+        std::vector<std::shared_ptr<const CowNode<T>>> children; // Children (shared with other versions)
+
+        explicit CowNode(bool leaf) : isLeaf(leaf) {};
+
+        inline size_t numKeys()  const {return keys.size();}
+        inline size_t numChild() const {return children.size();}
+        inline size_t getGtKeyIdx(T key) const {return SIMDOptimizer<T>::getGtKeyIdxSpecialized(keys, key);}
+    };
+
+    /**
+     * Path-copying B+ tree: writers serialize on a mutex and publish a new version per write,
+     * readers work on an immutable Snapshot and never wait for a write in progress.
+     */
+    template <typename T>
+    class CowBPlusTree : public ITree<T> {
+        private:
+            using NodePtr = std::shared_ptr<const CowNode<T>>;
+            struct Version {
+                NodePtr  root;          // nullptr for an empty tree
+                int      size = 0;
+                uint64_t version = 0;
+            };
+
+        public:
+            class Iterator;
+
+            /** Immutable view of one version, it keeps every node of that version alive. */
+            class Snapshot {
+                public:
+                    std::optional<T> get(T key) const;
+                    std::vector<T>   toVec() const;
+                    void forEach(const std::function<void(const T&)> &visitor) const;
+                    Iterator begin() const;
+                    Iterator end() const {return Iterator();}
+                    int      size() const {return version_->size;}
+                    uint64_t version() const {return version_->version;}
+
+                private:
+                    friend class CowBPlusTree;
+                    explicit Snapshot(std::shared_ptr<const Version> version): version_(std::move(version)) {}
+                    std::shared_ptr<const Version> version_;
+            };
+
+            /** Forward iterator over one version, nodes have no leaf links so it keeps its root path. */
+            class Iterator {
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type        = T;
+                    using difference_type   = std::ptrdiff_t;
+                    using pointer           = void;
+                    using reference         = T;
+
+                    explicit Iterator(std::shared_ptr<const Version> version = nullptr);
+                    T         operator*() const;
+                    Iterator &operator++();
+                    bool operator==(const Iterator &other) const;
+                    bool operator!=(const Iterator &other) const;
+
+                private:
+                    std::shared_ptr<const Version> version;
+                    std::vector<std::pair<const CowNode<T>*, size_t>> path;   // (node, child or key index)
+                    void descend(const CowNode<T> *node);
+                    void advanceLeaf();
+            };
+
+            explicit CowBPlusTree(int order = 3);
+            ~CowBPlusTree();
+            bool debug_checkIsValid(bool verbose);
+            int  size();
+
+            void insert(T key);
+            bool remove(T key);
+            void print();
+            std::optional<T> get(T key);
+            std::vector<T> toVec();
+            void forEach(const std::function<void(const T&)> &visitor);
+            MemoryStats memoryStats();
+
+            /** Pin the current version in O(1), it waits at most for another pointer copy. */
+            Snapshot snapshot() const;
+            /** Iterators run on a snapshot taken by begin(). */
+            Iterator begin();
+            Iterator end();
+
+        private:
+            struct InsertResult {
+                NodePtr node;
+                std::optional<std::pair<T, NodePtr>> split;     // (separator, new right node)
+            };
+
+            int ORDER_;
+            std::mutex writeLock;
+            std::shared_ptr<const Version> current;     // Only accessed through std::atomic_load / store
+
+            inline size_t minKeys() const {return (ORDER_ - 1) / 2;}
+            void publish(NodePtr root, int size);
+            InsertResult insertRec(const CowNode<T> &node, T key);
+            std::pair<T, NodePtr> splitNode(CowNode<T> &node);
+            std::shared_ptr<CowNode<T>> removeRec(const CowNode<T> &node, T key);
+            void fixUnderflow(CowNode<T> &parent, size_t index);
+            bool checkNode(const CowNode<T> &node, std::optional<T> lower, std::optional<T> upper,
+                           int depth, bool isRoot, int &leafDepth, int &keyCount);
     };
 
     /*
@@ -353,29 +662,37 @@ namespace Tree {
      * where order >= 3.
      */
     constexpr size_t LockQueueMaxSize = 32;
-    template <typename T>
+    template <typename T, int Order = 0>
     struct LockManager {
         bool isShared;
-        FineNode<T> *nodes[LockQueueMaxSize];
+        FineNode<T, Order> *nodes[LockQueueMaxSize];
         size_t start = 0, end = 0;
+#ifdef LOCK_PROFILE
+        uint64_t acquiredAt[LockQueueMaxSize];  // Acquisition timestamp of nodes[i], i is also its level
+#endif
 
         explicit LockManager(bool isShared = false): isShared(isShared){}
-        void retrieveLock(FineNode<T> *ptr);
-        bool isLocked(FineNode<T> *ptr);
+        void retrieveLock(FineNode<T, Order> *ptr);
+        bool isLocked(FineNode<T, Order> *ptr);
         void releaseAll();
         void releasePrev();
-        void popAndDelete(FineNode<T> *ptr);
+        void popAndDelete(FineNode<T, Order> *ptr);
     };
 
-    template<typename T>
+    template <typename T, int Order = 0>
     class FineLockBPlusTree : public ITree<T> {
         private:
-            FineNode<T> rootPtr;
+            FineNode<T, Order> rootPtr;
             int ORDER_;
             std::atomic<int> size_ = 0;
+
+            inline int order() const {
+                if constexpr (Order > 0) return Order;
+                else                     return ORDER_;
+            }
         
         public:
-            FineLockBPlusTree(int order = 3);
+            FineLockBPlusTree(int order = Order > 0 ? Order : 3);
             ~FineLockBPlusTree();
             bool debug_checkIsValid(bool verbose);
             int  size();
@@ -385,22 +702,177 @@ namespace Tree {
             void print();
             std::optional<T> get(T key);
             std::vector<T> toVec();
-            FineNode<T> *getRoot();
+            void forEach(const std::function<void(const T&)> &visitor);
+            /** NOTE: Walks the nodes without latches, only call it while no thread is writing. */
+            MemoryStats memoryStats();
+            FineNode<T, Order> *getRoot();
+
+            /**
+             * Same as SeqBPlusTree::compactLeaves, every leaf is packed under its exclusive latch.
+             * NOTE: Walks the leaf list without latch coupling, writers must be quiescent.
+             */
+            size_t compactLeaves(double minFill = 0.5, bool coldOnly = true);
+
+            /**
+             * Build the tree bottom-up from a sorted run: the keys are spread evenly over as few
+             * leaves as hold them, and every level above is built from the one below.
+             * NOTE: Only on an empty tree, writers must be quiescent.
+             */
+            void buildSorted(const std::vector<T> &keys);
+
+            /**
+             * Latch-coupled cursor over the leaf linked list. It holds a shared latch on the leaf
+             * it points to, and try-latches the neighbour leaf before releasing the current one
+             * (falling back to a search from the root). Since it owns a latch it can only be moved,
+             * not copied.
+             */
+            class Iterator {
+                public:
+                    /**
+                     * NOTE: leaf (if any) must already be latched in shared mode by the caller.
+                     * from is the first key the cursor may return, used if it has to restart.
+                     */
+                    explicit Iterator(FineNode<T, Order> *root = nullptr, FineNode<T, Order> *leaf = nullptr, size_t index = 0,
+                                      T from = std::numeric_limits<T>::lowest());
+                    Iterator(Iterator &&other) noexcept;
+                    Iterator &operator=(Iterator &&other) noexcept;
+                    Iterator(const Iterator &) = delete;
+                    Iterator &operator=(const Iterator &) = delete;
+                    ~Iterator();
+
+                    T         operator*() const;
+                    Iterator &operator++();
+                    Iterator &operator--();
+                    bool operator==(const Iterator &other) const;
+                    bool operator!=(const Iterator &other) const;
+
+                private:
+                    FineNode<T, Order> *root;  // Dummy root, needed to step back from end()
+                    FineNode<T, Order> *leaf;  // nullptr for end()
+                    size_t index;
+                    T    bound;    // The position is the first key not less than (or, if after, greater than) bound
+                    bool after;
+                    void skipForward();
+                    void seek(T key, bool after);
+                    void release();
+            };
+            Iterator begin();
+            Iterator end();
+            /** First key not less than key. */
+            Iterator lowerBound(T key);
         
         private:
             // Private helper functions
-            FineNode<T>* findLeafNodeInsert(FineNode<T>* node, T key, LockManager<T> &dq);
-            FineNode<T>* findLeafNodeDelete(FineNode<T>* node, T key, LockManager<T> &dq);
-            FineNode<T>* findLeafNodeRead(FineNode<T>* node, T key, LockManager<T> &dq);
+            FineNode<T, Order>* findLeafNodeInsert(FineNode<T, Order>* node, T key, LockManager<T, Order> &dq);
+            FineNode<T, Order>* findLeafNodeDelete(FineNode<T, Order>* node, T key, LockManager<T, Order> &dq);
+            FineNode<T, Order>* findLeafNodeRead(FineNode<T, Order>* node, T key, LockManager<T, Order> &dq);
 
-            void splitNode(FineNode<T>* node, T key);
-            void insertKey(FineNode<T>* node, T key);
-            bool removeFromLeaf(FineNode<T>* node, T key);
+            void splitNode(FineNode<T, Order>* node, T key);
+            void insertKey(FineNode<T, Order>* node, T key);
+            bool removeFromLeaf(FineNode<T, Order>* node, T key);
+            void thawSibling(FineNode<T, Order>* node);
 
-            bool isHalfFull(FineNode<T>* node);
-            bool moreHalfFull(FineNode<T>* node);
+            bool isHalfFull(FineNode<T, Order>* node);
+            bool moreHalfFull(FineNode<T, Order>* node);
 
-            void removeBorrow(FineNode<T>* node, LockManager<T> &dq);
-            void removeMerge(FineNode<T>* node, LockManager<T> &dq);
+            void removeBorrow(FineNode<T, Order>* node, LockManager<T, Order> &dq);
+            void removeMerge(FineNode<T, Order>* node, LockManager<T, Order> &dq);
     };
+
+    /**
+     * Marks inner trees that are safe to call concurrently. ShardedTree guards any other inner
+     * tree with a per-shard reader-writer lock.
+     */
+    template <template <typename> class Inner>
+    struct IsConcurrentTree : std::false_type {};
+    template <> struct IsConcurrentTree<CoarseLockBPlusTree> : std::true_type {};
+    template <> struct IsConcurrentTree<CombineBPlusTree>    : std::true_type {};
+    template <> struct IsConcurrentTree<CowBPlusTree>        : std::true_type {};
+    template <> struct IsConcurrentTree<FineLockBPlusTree>   : std::true_type {};
+
+    /*
+     * A shard is checked for imbalance every ShardRebalanceCheck operations it serves, and is
+     * split with a neighbour when it served more than ShardRebalanceFactor times the average.
+     */
+    constexpr int      ShardDefaultNum      = 16;
+    constexpr uint64_t ShardRebalanceCheck  = 1024;
+    constexpr uint64_t ShardRebalanceFactor = 2;
+
+    template<typename T, template <typename> class Inner = SeqBPlusTree>
+    class ShardedTree : public ITree<T> {
+        static_assert(std::is_arithmetic<T>::value, "ShardedTree partitions an arithmetic key domain");
+        private:
+            struct Shard {
+                Inner<T> tree;
+                BRLock   lock;      // Unused when Inner is concurrent
+                alignas(64) std::atomic<uint64_t> ops{0};
+                explicit Shard(int order): tree(order) {}
+            };
+
+            int ORDER_;
+            std::vector<std::unique_ptr<Shard>> shards;
+            std::vector<T> bounds;      // shard i holds keys in [bounds[i - 1], bounds[i])
+            BRLock routeLock;           // Shared by every operation, exclusive while repartitioning
+            std::mutex rebalanceLock;
+            std::atomic<uint64_t> rebalances{0};
+
+        public:
+            /**
+             * NOTE: Without a key range the whole domain of T is split, so small non-negative keys
+             * all land in one shard. Pass the workload's range where it is known.
+             */
+            explicit ShardedTree(int order = 3, int numShards = ShardDefaultNum);
+            ShardedTree(int order, int numShards, T keyLow, T keyHigh);
+            ~ShardedTree();
+            bool debug_checkIsValid(bool verbose);
+            int  size();
+
+            void insert(T key);
+            bool remove(T key);
+            void print();
+            std::optional<T> get(T key);
+            std::vector<T> toVec();
+            void forEach(const std::function<void(const T&)> &visitor);
+            /** Stats of every shard merged, plus the routing tables. */
+            MemoryStats memoryStats();
+            void insertSorted(const std::vector<T> &keys);
+            size_t eraseSorted(const std::vector<T> &keys);
+
+            /**
+             * Forward iterator chaining the inner trees' iterators shard by shard.
+             * NOTE: Takes no routing or shard lock, only use it while no thread is writing. A write
+             * may also rebalance, moving keys between shards, which an iterator would skip or see twice.
+             */
+            class Iterator {
+                public:
+                    Iterator(ShardedTree *tree, size_t shard, typename Inner<T>::Iterator it);
+                    T         operator*() const;
+                    Iterator &operator++();
+                    bool operator==(const Iterator &other) const;
+                    bool operator!=(const Iterator &other) const;
+
+                private:
+                    ShardedTree *tree;
+                    size_t shard;
+                    typename Inner<T>::Iterator it;
+                    void skipEmpty();
+            };
+            Iterator begin();
+            Iterator end();
+
+            int numShards() const;
+            uint64_t numRebalances() const;
+
+        private:
+            size_t shardOf(T key) const;
+            template <bool Write, typename Fn>
+            auto route(T key, Fn &&fn);
+            template <typename Fn>
+            void routeSorted(const std::vector<T> &keys, Fn &&fn);
+            void maybeRebalance(size_t hot);
+            void moveRange(size_t from, size_t to);
+    };
+
+    template <typename T>
+    using ShardedSeqTree = ShardedTree<T, SeqBPlusTree>;
 };
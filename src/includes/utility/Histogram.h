@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * Log-linear (HDR-style) histogram over non-negative integer samples (e.g. nanoseconds).
+ *
+ * Every power-of-two range [2^k, 2^(k+1)) is split into 2^SubBucketBits linear sub-buckets,
+ * so a reported percentile is off by at most 1 / 2^SubBucketBits of its value. Recording is
+ * a couple of shifts and one increment, there is no allocation and no synchronization: keep
+ * one histogram per thread and merge() them once the threads are done.
+ */
+template <int SubBucketBits = 4>
+class BasicHistogram {
+public:
+    static constexpr int SubBuckets = 1 << SubBucketBits;
+    static constexpr int NumBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+    BasicHistogram() { reset(); }
+
+    void reset() {
+        std::memset(buckets, 0, sizeof(buckets));
+        total = 0;
+        sum   = 0;
+        max_  = 0;
+        min_  = UINT64_MAX;
+    }
+
+    inline void record(uint64_t value) {
+        buckets[indexOf(value)] ++;
+        total ++;
+        sum += value;
+        if (value > max_) max_ = value;
+        if (value < min_) min_ = value;
+    }
+
+    void merge(const BasicHistogram &other) {
+        for (int idx = 0; idx < NumBuckets; idx ++) buckets[idx] += other.buckets[idx];
+        total += other.total;
+        sum   += other.sum;
+        max_   = std::max(max_, other.max_);
+        min_   = std::min(min_, other.min_);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max()   const { return max_; }
+    uint64_t min()   const { return total == 0 ? 0 : min_; }
+    double   mean()  const { return total == 0 ? 0.0 : static_cast<double>(sum) / total; }
+
+    /**
+     * Return the (upper bound of the) bucket holding the p-th percentile, p in [0, 100].
+     * The result is clamped to the largest recorded sample.
+     */
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+
+        uint64_t seen = 0;
+        for (int idx = 0; idx < NumBuckets; idx ++) {
+            seen += buckets[idx];
+            if (seen >= rank) return std::min(bucketUpper(idx), max_);
+        }
+        return max_;
+    }
+
+    /** Visit every non-empty bucket as fn(lower, upper, count), in increasing order. */
+    template <typename Fn>
+    void forEachBucket(Fn &&fn) const {
+        for (int idx = 0; idx < NumBuckets; idx ++) {
+            if (buckets[idx] != 0) fn(bucketLower(idx), bucketUpper(idx), buckets[idx]);
+        }
+    }
+
+    /** Raw bucket counters, so histograms can be reduced across MPI ranks as a flat array. */
+    uint64_t       *data()       { return buckets; }
+    const uint64_t *data() const { return buckets; }
+
+private:
+    uint64_t buckets[NumBuckets];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max_;
+    uint64_t min_;
+
+    static inline int indexOf(uint64_t value) {
+        if (value < SubBuckets) return static_cast<int>(value);
+        int msb   = 63 - __builtin_clzll(value);
+        int shift = msb - SubBucketBits;
+        return (shift + 1) * SubBuckets + static_cast<int>((value >> shift) - SubBuckets);
+    }
+
+    static inline uint64_t bucketLower(int idx) {
+        if (idx < SubBuckets) return idx;
+        int shift = idx / SubBuckets - 1;
+        return static_cast<uint64_t>(SubBuckets + idx % SubBuckets) << shift;
+    }
+
+    static inline uint64_t bucketUpper(int idx) {
+        if (idx < SubBuckets) return idx;
+        int shift = idx / SubBuckets - 1;
+        return bucketLower(idx) + (uint64_t(1) << shift) - 1;
+    }
+};
+
+using LatencyHistogram = BasicHistogram<4>;
+
+/** Latency of each kind of tree operation, in ns. */
+struct OpLatency {
+    LatencyHistogram insert, remove, get;
+
+    void merge(const OpLatency &other) {
+        insert.merge(other.insert);
+        remove.merge(other.remove);
+        get.merge(other.get);
+    }
+};
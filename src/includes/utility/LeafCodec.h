@@ -0,0 +1,175 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__x86_64__)
+    #include <emmintrin.h>
+#endif
+
+/**
+ * Frame-of-reference encoding for the keys of a frozen (packed) leaf.
+ *
+ * A packed leaf reuses its own key vector as storage, so raw leaves pay nothing for the option:
+ *      keys[0] = base (smallest key), keys[1] = number of keys,
+ *      then one `width`-byte delta (key - base) per key, width being 1, 2 or 4 bytes.
+ * Only integral keys whose range within the leaf fits a width narrower than T are packed.
+ * Searches compare 16-byte blocks of deltas against (key - base) without decoding them.
+ */
+
+namespace Tree {
+    template <typename T>
+    struct LeafCodec {
+        static constexpr bool   Enabled = std::is_integral<T>::value && sizeof(T) > 1;
+        static constexpr size_t Header  = 2;
+
+        /** Narrowest delta width (bytes) for sorted keys, 0 if packing would not save space. */
+        static uint8_t widthFor(const std::vector<T> &keys) {
+            if constexpr (!Enabled) return 0;
+            else {
+                if (keys.empty()) return 0;
+                uint64_t range = toDelta(keys.back(), keys.front());
+                uint8_t width = range <= 0xFF ? 1 : range <= 0xFFFF ? 2 : range <= 0xFFFFFFFF ? 4 : 0;
+                if (width == 0 || width >= sizeof(T)) return 0;
+                // Header costs two keys, small leaves are cheaper raw
+                size_t packedSlots = Header + (keys.size() * width + sizeof(T) - 1) / sizeof(T);
+                return packedSlots < keys.size() ? width : 0;
+            }
+        }
+
+        /** Replace the sorted raw keys by their packed form, the result is allocated to fit exactly. */
+        static void encode(std::vector<T> &keys, uint8_t width) {
+            if constexpr (Enabled) {
+                size_t n = keys.size();
+                std::vector<T> packed(Header + (n * width + sizeof(T) - 1) / sizeof(T));
+                packed[0] = keys[0];
+                packed[1] = static_cast<T>(n);
+                uint8_t *out = deltas(packed);
+                for (size_t idx = 0; idx < n; idx ++) {
+                    uint64_t delta = toDelta(keys[idx], keys[0]);
+                    switch (width) {
+                        case 1: storeAs<uint8_t >(out + idx, delta); break;
+                        case 2: storeAs<uint16_t>(out + idx * 2, delta); break;
+                        default: storeAs<uint32_t>(out + idx * 4, delta); break;
+                    }
+                }
+                keys.swap(packed);
+            }
+        }
+
+        static void decode(std::vector<T> &keys, uint8_t width, size_t capacity) {
+            std::vector<T> raw;
+            raw.reserve(std::max(capacity, size(keys)));
+            forEach(keys, width, [&raw](T key) { raw.push_back(key); });
+            keys.swap(raw);
+        }
+
+        static inline size_t size(const std::vector<T> &packed) {
+            if constexpr (Enabled) return static_cast<size_t>(packed[1]);
+            else return 0;
+        }
+
+        static inline T at(const std::vector<T> &packed, uint8_t width, size_t idx) {
+            const uint8_t *data = deltas(packed);
+            switch (width) {
+                case 1: return fromDelta(packed[0], loadAs<uint8_t >(data + idx));
+                case 2: return fromDelta(packed[0], loadAs<uint16_t>(data + idx * 2));
+                default: return fromDelta(packed[0], loadAs<uint32_t>(data + idx * 4));
+            }
+        }
+
+        /** Number of keys <= key, i.e. the same index getGtKeyIdx returns on raw keys. */
+        static size_t upperBound(const std::vector<T> &packed, uint8_t width, T key) {
+            size_t n = size(packed);
+            if (key < packed[0]) return 0;
+            uint64_t delta = toDelta(key, packed[0]);
+            const uint8_t *data = deltas(packed);
+            switch (width) {
+                case 1:  return delta > 0xFF       ? n : countLE<uint8_t >(data, n, delta);
+                case 2:  return delta > 0xFFFF     ? n : countLE<uint16_t>(data, n, delta);
+                default: return delta > 0xFFFFFFFF ? n : countLE<uint32_t>(data, n, delta);
+            }
+        }
+
+        template <typename Fn>
+        static void forEach(const std::vector<T> &packed, uint8_t width, Fn &&fn) {
+            size_t n = size(packed);
+            for (size_t idx = 0; idx < n; idx ++) fn(at(packed, width, idx));
+        }
+
+    private:
+        static inline uint8_t *deltas(std::vector<T> &packed) {
+            return reinterpret_cast<uint8_t *>(packed.data() + Header);
+        }
+        static inline const uint8_t *deltas(const std::vector<T> &packed) {
+            return reinterpret_cast<const uint8_t *>(packed.data() + Header);
+        }
+
+        static inline uint64_t toDelta(T key, T base) {
+            if constexpr (Enabled) {
+                using U = std::make_unsigned_t<T>;
+                return static_cast<uint64_t>(static_cast<U>(static_cast<U>(key) - static_cast<U>(base)));
+            } else return 0;
+        }
+
+        static inline T fromDelta(T base, uint64_t delta) {
+            if constexpr (Enabled) {
+                using U = std::make_unsigned_t<T>;
+                return static_cast<T>(static_cast<U>(static_cast<U>(base) + static_cast<U>(delta)));
+            } else return base;
+        }
+
+        template <typename D>
+        static inline void storeAs(uint8_t *dst, uint64_t value) {
+            D narrow = static_cast<D>(value);
+            std::memcpy(dst, &narrow, sizeof(D));
+        }
+
+        template <typename D>
+        static inline D loadAs(const uint8_t *src) {
+            D value;
+            std::memcpy(&value, src, sizeof(D));
+            return value;
+        }
+
+        /** Deltas are sorted, so the answer is the index of the first one greater than delta. */
+        template <typename D>
+        static size_t countLE(const uint8_t *data, size_t n, uint64_t delta) {
+            const D bound = static_cast<D>(delta);
+            size_t idx = 0;
+#if defined(__x86_64__) && !defined(NOSIMD)
+            // SSE2 only has signed compares, flipping the sign bit turns them into unsigned ones
+            constexpr size_t lanes = 16 / sizeof(D);
+            __m128i bias, boundVec;
+            if constexpr (sizeof(D) == 1) {
+                bias     = _mm_set1_epi8(static_cast<char>(0x80));
+                boundVec = _mm_set1_epi8(static_cast<char>(bound));
+            } else if constexpr (sizeof(D) == 2) {
+                bias     = _mm_set1_epi16(static_cast<short>(0x8000));
+                boundVec = _mm_set1_epi16(static_cast<short>(bound));
+            } else {
+                bias     = _mm_set1_epi32(static_cast<int>(0x80000000u));
+                boundVec = _mm_set1_epi32(static_cast<int>(bound));
+            }
+            boundVec = _mm_xor_si128(boundVec, bias);
+
+            for (; idx + lanes <= n; idx += lanes) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + idx * sizeof(D)));
+                block = _mm_xor_si128(block, bias);
+                __m128i greater;
+                if constexpr (sizeof(D) == 1)      greater = _mm_cmpgt_epi8 (block, boundVec);
+                else if constexpr (sizeof(D) == 2) greater = _mm_cmpgt_epi16(block, boundVec);
+                else                               greater = _mm_cmpgt_epi32(block, boundVec);
+                int mask = _mm_movemask_epi8(greater);
+                if (mask != 0) return idx + __builtin_ctz(mask) / sizeof(D);
+            }
+#endif
+            for (; idx < n; idx ++) {
+                if (loadAs<D>(data + idx * sizeof(D)) > bound) return idx;
+            }
+            return n;
+        }
+    };
+}
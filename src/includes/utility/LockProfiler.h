@@ -0,0 +1,149 @@
+#pragma once
+#include <mutex>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include "utility/Histogram.h"
+#include "utility/timing.h"
+
+/**
+ * Opt-in latch contention profiler for the fine-grained B+ tree.
+ *
+ * Compile with -DLOCK_PROFILE (cmake -DLOCK_PROFILE=ON) to enable it. Every LockManager then
+ * records, per tree level, how long it waited to acquire a latch and how long it held it,
+ * together with the number of descents that could not release their ancestors because a
+ * node was unsafe (full on insert, at most half full on delete).
+ *
+ * Samples are written to a thread-local Stats object, so profiling adds no shared cache
+ * traffic on the hot path. collect() merges all live and exited threads; call it (and
+ * reset()) only when the tree is quiescent, e.g. between benchmark runs.
+ *
+ * Without LOCK_PROFILE the LOCK_PROFILE_DO(...) hooks expand to nothing.
+ */
+
+#ifdef LOCK_PROFILE
+#define LOCK_PROFILE_DO(arg) do { arg; } while (0);
+#else
+#define LOCK_PROFILE_DO(arg) {}
+#endif
+
+namespace LockProfile {
+    /** Levels deeper than MaxLevel - 1 are folded into the last slot. */
+    constexpr int MaxLevel = 16;
+    /** 4 sub-buckets per power of two keeps each per-level histogram at 2KB. */
+    using Histogram = BasicHistogram<2>;
+
+    struct LevelStats {
+        uint64_t  acquisitions = 0;
+        Histogram wait;     // ns spent in lock() / lock_shared()
+        Histogram hold;     // ns between acquisition and release
+    };
+
+    struct Stats {
+        LevelStats levels[MaxLevel];
+        uint64_t   unsafeNodes = 0;    // failed safe-node releases on insert / delete descents
+
+        inline void onAcquire(size_t level, uint64_t waitNs) {
+            LevelStats &lv = levels[std::min<size_t>(level, MaxLevel - 1)];
+            lv.acquisitions ++;
+            lv.wait.record(waitNs);
+        }
+
+        inline void onRelease(size_t level, uint64_t holdNs) {
+            levels[std::min<size_t>(level, MaxLevel - 1)].hold.record(holdNs);
+        }
+
+        void merge(const Stats &other) {
+            for (int lv = 0; lv < MaxLevel; lv ++) {
+                levels[lv].acquisitions += other.levels[lv].acquisitions;
+                levels[lv].wait.merge(other.levels[lv].wait);
+                levels[lv].hold.merge(other.levels[lv].hold);
+            }
+            unsafeNodes += other.unsafeNodes;
+        }
+
+        void reset() {
+            for (auto &lv : levels) {
+                lv.acquisitions = 0;
+                lv.wait.reset();
+                lv.hold.reset();
+            }
+            unsafeNodes = 0;
+        }
+
+        uint64_t acquisitions() const {
+            uint64_t cnt = 0;
+            for (const auto &lv : levels) cnt += lv.acquisitions;
+            return cnt;
+        }
+
+        /** Level 0 is the dummy root sentinel, level 1 the real root, and so on. */
+        void print(std::ostream &os) const {
+            os << "\tLatch profile (ns)   unsafe nodes: " << unsafeNodes << std::endl;
+            os << "\t  level    acquired   wait_avg   wait_p99   hold_avg   hold_p99" << std::endl;
+            for (int lv = 0; lv < MaxLevel; lv ++) {
+                const LevelStats &s = levels[lv];
+                if (s.acquisitions == 0) continue;
+                os << "\t  " << std::setw(5) << lv
+                   << std::setw(12) << s.acquisitions
+                   << std::setw(11) << static_cast<uint64_t>(s.wait.mean())
+                   << std::setw(11) << s.wait.percentile(99)
+                   << std::setw(11) << static_cast<uint64_t>(s.hold.mean())
+                   << std::setw(11) << s.hold.percentile(99) << std::endl;
+            }
+        }
+    };
+
+    class Registry {
+    public:
+        static Registry &instance() {
+            static Registry registry;
+            return registry;
+        }
+
+        void attach(Stats *stats) {
+            std::lock_guard<std::mutex> guard(mtx);
+            live.push_back(stats);
+        }
+
+        void detach(Stats *stats) {
+            std::lock_guard<std::mutex> guard(mtx);
+            retired.merge(*stats);
+            live.erase(std::remove(live.begin(), live.end(), stats), live.end());
+        }
+
+        Stats collect() {
+            std::lock_guard<std::mutex> guard(mtx);
+            Stats result = retired;
+            for (Stats *stats : live) result.merge(*stats);
+            return result;
+        }
+
+        void reset() {
+            std::lock_guard<std::mutex> guard(mtx);
+            retired.reset();
+            for (Stats *stats : live) stats->reset();
+        }
+
+    private:
+        std::mutex          mtx;
+        std::vector<Stats*> live;
+        Stats               retired;
+    };
+
+    /** Per-thread slot, folded into the registry when the thread exits. */
+    struct ThreadStats {
+        Stats stats;
+        ThreadStats()  { Registry::instance().attach(&stats); }
+        ~ThreadStats() { Registry::instance().detach(&stats); }
+    };
+
+    inline Stats &local() {
+        thread_local ThreadStats slot;
+        return slot.stats;
+    }
+
+    inline Stats collect() { return Registry::instance().collect(); }
+    inline void  reset()   { Registry::instance().reset(); }
+}
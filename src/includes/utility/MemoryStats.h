@@ -0,0 +1,129 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+/**
+ * Space accounting of a tree, collected by walking its nodes (see collectMemoryStats).
+ *
+ * Bytes are what the nodes hold on to, not what the allocator hands out: a node counts
+ * sizeof(node) (latches, flags, container headers), the allocated capacity of its key vector
+ * and the chunk storage of its child container. Allocator headers and padding are not counted.
+ * Deques are charged like libstdc++ lays them out, 512-byte chunks plus a map of chunk pointers.
+ */
+
+namespace Tree {
+    struct MemoryStats {
+        struct LevelStats {
+            size_t nodes = 0;
+            size_t keys  = 0;
+        };
+
+        std::vector<LevelStats> levels;     // levels[0] is the root
+        size_t keys              = 0;       // Keys stored in the leaves
+        size_t leaves            = 0;
+        size_t maxKeysPerNode    = 0;       // order - 1
+        size_t usedKeySlots      = 0;       // Key slots in use (a packed leaf uses fewer slots than keys)
+        size_t allocatedKeySlots = 0;       // Key slots allocated (vector capacity)
+        size_t nodeBytes         = 0;
+        size_t keyBytes          = 0;
+        size_t childBytes        = 0;
+        size_t otherBytes        = 0;       // Tree object, shard tables, version headers, ...
+        size_t copyBytes         = 0;       // Further copies of the keys, replicas and mirrors
+
+        size_t numNodes() const {
+            size_t total = 0;
+            for (const LevelStats &lv : levels) total += lv.nodes;
+            return total;
+        }
+
+        size_t totalBytes() const {return nodeBytes + keyBytes + childBytes + otherBytes + copyBytes;}
+
+        /** Keys per leaf over the keys a leaf can hold. */
+        double fillFactor() const {
+            return leaves * maxKeysPerNode == 0 ? 0.0 : static_cast<double>(keys) / (leaves * maxKeysPerNode);
+        }
+
+        double slotUtilization() const {
+            return allocatedKeySlots == 0 ? 0.0 : static_cast<double>(usedKeySlots) / allocatedKeySlots;
+        }
+
+        double bytesPerKey() const {
+            return keys == 0 ? 0.0 : static_cast<double>(totalBytes()) / keys;
+        }
+
+        /** Add the stats of another tree, levels are aligned at the root. */
+        void merge(const MemoryStats &other) {
+            if (levels.size() < other.levels.size()) levels.resize(other.levels.size());
+            for (size_t lv = 0; lv < other.levels.size(); lv ++) {
+                levels[lv].nodes += other.levels[lv].nodes;
+                levels[lv].keys  += other.levels[lv].keys;
+            }
+            keys              += other.keys;
+            leaves            += other.leaves;
+            maxKeysPerNode     = std::max(maxKeysPerNode, other.maxKeysPerNode);
+            usedKeySlots      += other.usedKeySlots;
+            allocatedKeySlots += other.allocatedKeySlots;
+            nodeBytes         += other.nodeBytes;
+            keyBytes          += other.keyBytes;
+            childBytes        += other.childBytes;
+            otherBytes        += other.otherBytes;
+            copyBytes         += other.copyBytes;
+        }
+
+        void print(std::ostream &os) const {
+            os << std::fixed << std::setprecision(2)
+               << "\tMemory: " << static_cast<double>(totalBytes()) / (1 << 20) << "MB, "
+               << bytesPerKey() << " B/key, fill " << fillFactor() * 100 << "%, key slots "
+               << usedKeySlots << " / " << allocatedKeySlots << std::endl;
+            os << "\t  level       nodes        keys" << std::endl;
+            for (size_t lv = 0; lv < levels.size(); lv ++) {
+                os << "\t  " << std::setw(5) << lv
+                   << std::setw(12) << levels[lv].nodes
+                   << std::setw(12) << levels[lv].keys << std::endl;
+            }
+            os << "\t  bytes: nodes " << nodeBytes << ", keys " << keyBytes
+               << ", children " << childBytes << ", other " << otherBytes << ", copies " << copyBytes << std::endl;
+            os.unsetf(std::ios_base::floatfield);
+        }
+    };
+
+    template <typename E>
+    inline size_t containerBytes(const std::vector<E> &vec) {
+        return vec.capacity() * sizeof(E);
+    }
+
+    template <typename E>
+    inline size_t containerBytes(const std::deque<E> &deq) {
+        constexpr size_t chunkElems = sizeof(E) < 512 ? 512 / sizeof(E) : 1;
+        size_t chunks = deq.size() / chunkElems + 1;
+        return chunks * chunkElems * sizeof(E) + std::max<size_t>(8, chunks + 2) * sizeof(E*);
+    }
+
+    /**
+     * Account node and its subtree at the given level. Works for every node type holding
+     * `keys` and a container of (raw or shared) child pointers; nodeOverhead is charged per
+     * node on top of sizeof(Node), e.g. a shared_ptr control block.
+     */
+    template <typename Node>
+    void collectMemoryStats(Node *node, MemoryStats &stats, size_t level = 0, size_t nodeOverhead = 0) {
+        using Key = typename decltype(node->keys)::value_type;
+        if (stats.levels.size() <= level) stats.levels.resize(level + 1);
+
+        size_t numKeys = node->numKeys();
+        stats.levels[level].nodes ++;
+        stats.levels[level].keys += numKeys;
+        stats.usedKeySlots      += node->keys.size();
+        stats.allocatedKeySlots += node->keys.capacity();
+        stats.nodeBytes         += sizeof(Node) + nodeOverhead;
+        stats.keyBytes          += node->keys.capacity() * sizeof(Key);
+        stats.childBytes        += containerBytes(node->children);
+        if (node->isLeaf) {
+            stats.leaves ++;
+            stats.keys += numKeys;
+        }
+        for (auto &child : node->children) collectMemoryStats(&*child, stats, level + 1, nodeOverhead);
+    }
+}
@@ -30,6 +30,8 @@ namespace Tree {
         
     public:
         static inline size_t getGtKeyIdxSpecialized(const std::vector<T> &keys, T key);
+        template <size_t MaxKeys>
+        static inline size_t getGtKeyIdxBounded(const std::vector<T> &keys, T key);
         static void processAssignments(NodeMap<T> &assign_node_to_thread, Scheduler<T>* scheduler, size_t BATCHSIZE);
     };
 
@@ -95,6 +97,39 @@ namespace Tree {
         return index;
     }
 
+    /**
+     * Order-specialized getGtKeyIdx - the node never holds more than MaxKeys keys, so the loop
+     * trip count is a compile-time constant and the compiler fully unrolls it. Small nodes use a
+     * linear scan, larger ones a branch-free binary search (log2(MaxKeys) steps).
+     */
+    template <typename T>
+    template <size_t MaxKeys>
+    size_t SIMDOptimizer<T>::getGtKeyIdxBounded(const std::vector<T> &keys, T key) {
+        const size_t numKeys = keys.size();
+        const T *data = keys.data();
+        if constexpr (MaxKeys <= 16) {
+            size_t index = 0;
+#pragma GCC unroll 16
+            for (size_t i = 0; i < MaxKeys; i ++) {
+                if (i >= numKeys || data[i] > key) break;
+                index ++;
+            }
+            return index;
+        } else {
+            if (numKeys == 0) return 0;
+            const T *base = data;
+            size_t len = numKeys;
+#pragma GCC unroll 8
+            for (size_t step = MaxKeys; step > 1; step = (step + 1) / 2) {
+                if (len <= 1) break;
+                size_t half = len / 2;
+                base = (base[half] <= key) ? base + half : base;
+                len -= half;
+            }
+            return (base - data) + (*base <= key);
+        }
+    }
+
     /**
      * Specialized getGtKeyIdx - use SIMD to scan over the vector.
      */
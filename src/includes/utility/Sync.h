@@ -3,6 +3,8 @@
 
 #pragma once
 #include <atomic>
+#include <mutex>
+#include <thread>
 
 /**
  * Ticket lock, fair and efficient busy lock.
@@ -56,3 +58,63 @@ private:
     std::atomic<unsigned long> generation;
     int ExpectThreadNum;
 };
+
+/**
+ * Big-reader (per-core sharded) reader-writer lock.
+ *
+ * Every thread is pinned to one of NumShards cache-line padded reader counters, so concurrent
+ * readers do not bounce a single atomic between cores. A writer raises the writer flag and then
+ * waits for all shards to drain; readers that observe the flag back off, which gives writers
+ * preference and keeps a read-heavy workload from starving them.
+ *
+ * Satisfies SharedMutex, so it can be used with std::lock_guard and std::shared_lock.
+ */
+class BRLock {
+public:
+    static constexpr int NumShards = 16;
+
+    BRLock(): writer(false) {}
+
+    void lock_shared() {
+        std::atomic<int> &readers = shards[shardIdx()].readers;
+        while (true) {
+            while (writer.load(std::memory_order_acquire)) std::this_thread::yield();
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            // Pairs with the writer's store, either we see the flag or it sees our count
+            if (!writer.load(std::memory_order_seq_cst)) return;
+            readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void unlock_shared() {
+        shards[shardIdx()].readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock() {
+        writerLock.lock();
+        writer.store(true, std::memory_order_seq_cst);
+        for (auto &shard : shards) {
+            while (shard.readers.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+        }
+    }
+
+    void unlock() {
+        writer.store(false, std::memory_order_release);
+        writerLock.unlock();
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<int> readers{0};
+    };
+
+    Shard shards[NumShards];
+    alignas(64) std::atomic<bool> writer;
+    std::mutex writerLock;
+
+    static inline int shardIdx() {
+        static std::atomic<int> nextShard{0};
+        thread_local int idx = nextShard.fetch_add(1, std::memory_order_relaxed) % NumShards;
+        return idx;
+    }
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Binary trace (.bcase): a TraceHeader followed by count fixed-size TraceRecords, native byte
+ * order. The engines map the file and use the records in place, a trace is converted once from
+ * its text form ("I,17,NONE" / "G,12,12" / "BARRIER" per line) with traceConvert.
+ */
+
+enum TraceOp : uint8_t {TraceInsert, TraceRemove, TraceGet, TraceBarrier};
+
+constexpr char     TraceMagic[4] = {'B', 'F', 'T', 'R'};
+constexpr uint32_t TraceVersion  = 1;
+
+struct TraceHeader {
+    char     magic[4];
+    uint32_t version;
+    uint64_t count;         // Records following the header
+};
+
+struct TraceRecord {
+    int32_t  key;
+    TraceOp  op;
+    uint8_t  hasExpect;
+    uint16_t reserved;
+    int32_t  expect;        // Only meaningful if hasExpect
+};
+static_assert(sizeof(TraceHeader) == 16 && sizeof(TraceRecord) == 12, "on-disk layout");
+
+/** Parse one line of the text format, false if it is malformed. */
+inline bool parseTraceLine(const std::string &line, TraceRecord &record) {
+    record = TraceRecord{};
+    if (line == "BARRIER") {
+        record.op = TraceBarrier;
+        return true;
+    }
+    if (line.size() < 4 || line[1] != ',') return false;
+    if      (line[0] == 'I') record.op = TraceInsert;
+    else if (line[0] == 'D') record.op = TraceRemove;
+    else if (line[0] == 'G') record.op = TraceGet;
+    else return false;
+
+    const char *first = line.data() + 2, *last = line.data() + line.size();
+    auto [comma, error] = std::from_chars(first, last, record.key);
+    if (error != std::errc() || comma == last || *comma != ',') return false;
+    std::string expect(comma + 1, last);
+    if (!expect.empty() && expect.back() == '\r') expect.pop_back();
+    if (expect == "NONE") return true;
+    auto [end, expectError] = std::from_chars(expect.data(), expect.data() + expect.size(), record.expect);
+    record.hasExpect = 1;
+    return expectError == std::errc() && end == expect.data() + expect.size();
+}
+
+/** Parse a whole text trace, false if the file is missing or a line is malformed. */
+inline bool readTextTrace(const std::string &path, std::vector<TraceRecord> &records) {
+    FILE *file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) return false;
+    records.clear();
+    std::string line;
+    char buffer[256];
+    bool ok = true;
+    while (ok && std::fgets(buffer, sizeof(buffer), file) != nullptr) {
+        line.assign(buffer);
+        if (!line.empty() && line.back() == '\n') line.pop_back();
+        if (line.empty()) continue;
+        records.emplace_back();
+        ok = parseTraceLine(line, records.back());
+    }
+    std::fclose(file);
+    return ok;
+}
+
+inline bool writeBinaryTrace(const std::string &path, const std::vector<TraceRecord> &records) {
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    TraceHeader header;
+    std::memcpy(header.magic, TraceMagic, sizeof(TraceMagic));
+    header.version = TraceVersion;
+    header.count   = records.size();
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(records.data(), sizeof(TraceRecord), records.size(), file) == records.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+/**
+ * Read-only mapping of a binary trace. The pages are populated up front, so a run over the
+ * records does not fault them in while it is being timed.
+ */
+class MappedTrace {
+public:
+    MappedTrace() = default;
+    MappedTrace(const MappedTrace &) = delete;
+    MappedTrace &operator=(const MappedTrace &) = delete;
+    ~MappedTrace() { close(); }
+
+    /** False if the file is missing, or not a binary trace of this version. */
+    bool open(const std::string &path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(TraceHeader)) {
+            ::close(fd);
+            return false;
+        }
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void *addr = mmap(nullptr, info.st_size, PROT_READ, flags, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) return false;
+        base  = addr;
+        bytes = info.st_size;
+
+        const TraceHeader *header = static_cast<const TraceHeader *>(base);
+        if (std::memcmp(header->magic, TraceMagic, sizeof(TraceMagic)) != 0 || header->version != TraceVersion ||
+            bytes != sizeof(TraceHeader) + header->count * sizeof(TraceRecord)) {
+            close();
+            return false;
+        }
+        count = header->count;
+        return true;
+    }
+
+    void close() {
+        if (base != nullptr) munmap(base, bytes);
+        base  = nullptr;
+        bytes = 0;
+        count = 0;
+    }
+
+    const TraceRecord *records() const {
+        return reinterpret_cast<const TraceRecord *>(static_cast<const char *>(base) + sizeof(TraceHeader));
+    }
+    size_t size() const { return count; }
+
+private:
+    void  *base  = nullptr;
+    size_t bytes = 0;
+    size_t count = 0;
+};
@@ -1,5 +1,13 @@
 #pragma once
 #include <chrono>
+#include <cstdint>
+
+/** Monotonic timestamp in nanoseconds, for latency samples and the lock profiler. */
+inline uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
 
 class Timer {
 public:
@@ -3,23 +3,33 @@
 #include "seqTree/seqNode.hpp"
 #include "seqTree/seqTree.hpp"
 #include "coarseTree/coarseTree.hpp"
+#include "coarseTree/combineTree.hpp"
+#include "coarseTree/cowTree.hpp"
+#include "shardedTree/shardedTree.hpp"
 #include "fineTree/fineNode.hpp"
 #include "fineTree/fineTree.hpp"
 #include "freeTree/freeTree.hpp"
 
-enum TreeType {Sequential, CoarseGrain, FineGrain, LockFree, Distributed};
+enum TreeType {Sequential, CoarseGrain, FlatCombine, CopyOnWrite, Sharded, FineGrain, LockFree, Distributed};
 
 void MetaEngine(TreeType type, std::string const &name, std::vector<std::string> cases, Engine::EngineConfig const &cfg) {
     std::cout << "TESTCASE: " << name << std::endl;
     if (type == TreeType::Sequential) {
-        auto runner = Engine::BenchmarkEngine<Tree::SeqBPlusTree>(cfg);
-        runner.Run();
+        Engine::OrderDispatch<Engine::BenchmarkEngine, Tree::SeqBPlusTree>::Run(cfg);
     } else if (type == TreeType::CoarseGrain) {
         auto runner = Engine::BenchmarkEngine<Tree::CoarseLockBPlusTree>(cfg);
         runner.Run();
-    } else if (type == TreeType::FineGrain) {
-        auto runner = Engine::BenchmarkEngine<Tree::FineLockBPlusTree>(cfg);
+    } else if (type == TreeType::FlatCombine) {
+        auto runner = Engine::BenchmarkEngine<Tree::CombineBPlusTree>(cfg);
+        runner.Run();
+    } else if (type == TreeType::CopyOnWrite) {
+        auto runner = Engine::BenchmarkEngine<Tree::CowBPlusTree>(cfg);
         runner.Run();
+    } else if (type == TreeType::Sharded) {
+        auto runner = Engine::BenchmarkEngine<Tree::ShardedSeqTree>(cfg);
+        runner.Run();
+    } else if (type == TreeType::FineGrain) {
+        Engine::OrderDispatch<Engine::BenchmarkEngine, Tree::FineLockBPlusTree>::Run(cfg);
     } else if (type == TreeType::LockFree) {
         auto runner = Engine::BenchmarkEngine<Tree::FreeBPlusTree>(cfg);
         runner.Run();
@@ -31,15 +41,21 @@ void MetaEngine(TreeType type, std::string const &name, std::vector<std::string>
     }
 }
 
+/** Prefer the binary trace converted next to a text case, which is mapped instead of parsed. */
+std::string preferBinary(std::string const &casePath) {
+    std::string binary = casePath.substr(0, casePath.rfind(".case")) + ".bcase";
+    return access(binary.c_str(), R_OK) == 0 ? binary : casePath;
+}
+
 int main() {
     std::vector<std::string> Cases = {};
     for (int i = 0; i < 3; i ++) {
         std::string s = "../test/B_megaGet_" + std::to_string(i) + ".case";
-        Cases.push_back(s);
+        Cases.push_back(preferBinary(s));
     }
     for (int i = 0; i < 3; i ++) {
         std::string s = "../test/B_megaMix_" + std::to_string(i) + ".case";
-        Cases.push_back(s);
+        Cases.push_back(preferBinary(s));
     }
 
     int order = 9;
@@ -65,6 +81,24 @@ int main() {
     MetaEngine(TreeType::CoarseGrain, "CoarseGrain x6", Cases, parallelx6Cfg);
     MetaEngine(TreeType::CoarseGrain, "CoarseGrain x8", Cases, parallelx8Cfg);
 
+    MetaEngine(TreeType::FlatCombine, "FlatCombine x1", Cases, sequentialCfg);
+    MetaEngine(TreeType::FlatCombine, "FlatCombine x2", Cases, parallelx2Cfg);
+    MetaEngine(TreeType::FlatCombine, "FlatCombine x4", Cases, parallelx4Cfg);
+    MetaEngine(TreeType::FlatCombine, "FlatCombine x6", Cases, parallelx6Cfg);
+    MetaEngine(TreeType::FlatCombine, "FlatCombine x8", Cases, parallelx8Cfg);
+
+    MetaEngine(TreeType::CopyOnWrite, "CopyOnWrite x1", Cases, sequentialCfg);
+    MetaEngine(TreeType::CopyOnWrite, "CopyOnWrite x2", Cases, parallelx2Cfg);
+    MetaEngine(TreeType::CopyOnWrite, "CopyOnWrite x4", Cases, parallelx4Cfg);
+    MetaEngine(TreeType::CopyOnWrite, "CopyOnWrite x6", Cases, parallelx6Cfg);
+    MetaEngine(TreeType::CopyOnWrite, "CopyOnWrite x8", Cases, parallelx8Cfg);
+
+    MetaEngine(TreeType::Sharded    , "Sharded x1", Cases, sequentialCfg);
+    MetaEngine(TreeType::Sharded    , "Sharded x2", Cases, parallelx2Cfg);
+    MetaEngine(TreeType::Sharded    , "Sharded x4", Cases, parallelx4Cfg);
+    MetaEngine(TreeType::Sharded    , "Sharded x6", Cases, parallelx6Cfg);
+    MetaEngine(TreeType::Sharded    , "Sharded x8", Cases, parallelx8Cfg);
+
     MetaEngine(TreeType::FineGrain  , "FineGrain x1", Cases, sequentialCfg);
     MetaEngine(TreeType::FineGrain  , "FineGrain x2", Cases, parallelx2Cfg);
     MetaEngine(TreeType::FineGrain  , "FineGrain x4", Cases, parallelx4Cfg);
@@ -2,24 +2,34 @@
 #include "seqTree/seqNode.hpp"
 #include "seqTree/seqTree.hpp"
 #include "coarseTree/coarseTree.hpp"
+#include "coarseTree/combineTree.hpp"
+#include "coarseTree/cowTree.hpp"
+#include "shardedTree/shardedTree.hpp"
 #include "fineTree/fineNode.hpp"
 #include "fineTree/fineTree.hpp"
 #include "freeTree/freeNode.hpp"
 #include "freeTree/freeTree.hpp"
 
-enum TreeType {Sequential, CoarseGrain, FineGrain, LockFree, Distributed};
+enum TreeType {Sequential, CoarseGrain, FlatCombine, CopyOnWrite, Sharded, FineGrain, LockFree, Distributed};
 
 void MetaEngine(TreeType type, std::string const &name, std::vector<std::string> cases, Engine::EngineConfig const &cfg) {
     std::cout << "TESTCASE: " << name << std::endl;
     if (type == TreeType::Sequential) {
-        auto runner = Engine::SeqEngine<Tree::SeqBPlusTree>(cfg);
-        runner.Run();
+        Engine::OrderDispatch<Engine::SeqEngine, Tree::SeqBPlusTree>::Run(cfg);
     } else if (type == TreeType::CoarseGrain) {
         auto runner = Engine::ThreadEngine<Tree::CoarseLockBPlusTree>(cfg);
         runner.Run();
-    } else if (type == TreeType::FineGrain) {
-        auto runner = Engine::ThreadEngine<Tree::FineLockBPlusTree>(cfg);
+    } else if (type == TreeType::FlatCombine) {
+        auto runner = Engine::ThreadEngine<Tree::CombineBPlusTree>(cfg);
+        runner.Run();
+    } else if (type == TreeType::CopyOnWrite) {
+        auto runner = Engine::ThreadEngine<Tree::CowBPlusTree>(cfg);
         runner.Run();
+    } else if (type == TreeType::Sharded) {
+        auto runner = Engine::ThreadEngine<Tree::ShardedSeqTree>(cfg);
+        runner.Run();
+    } else if (type == TreeType::FineGrain) {
+        Engine::OrderDispatch<Engine::ThreadEngine, Tree::FineLockBPlusTree>::Run(cfg);
     } else if (type == TreeType::LockFree) {
         auto runner = Engine::BenchmarkEngine<Tree::FreeBPlusTree>(cfg);
         runner.Run();
@@ -41,12 +51,30 @@ int main(int argc, char **argv) {
 
     if (treeType == "Seq") type = TreeType::Sequential;
     else if (treeType == "Coarse") type = TreeType::CoarseGrain;
+    else if (treeType == "Combine") type = TreeType::FlatCombine;
+    else if (treeType == "Cow") type = TreeType::CopyOnWrite;
+    else if (treeType == "Sharded") type = TreeType::Sharded;
     else if (treeType == "Fine") type = TreeType::FineGrain;
     else if (treeType == "Free") type = TreeType::LockFree;
     else assert(false);
 
+    // A case given as a path (e.g. a converted ./small_0.bcase) is not under the test directory
+    if (caseName.find('/') != std::string::npos) baseDir = "";
     std::vector<std::string> Cases = {baseDir + caseName};
     Engine::EngineConfig config {order, numThread, 1, Cases};
+    // Optional flags after the case name:
+    //  "Packed"  - compress cold leaves at every BARRIER
+    //  "Batched" - apply runs of insert / remove as sorted batches (Seq only)
+    //  "KeyRange" - split the trace between threads by key range instead of key modulo
+    //  "Latency" - report per-op latency percentiles (BenchmarkEngine only, i.e. Free)
+    for (int arg = 5; arg < argc; arg ++) {
+        std::string flag = argv[arg];
+        if (flag == "Packed") config.compactLeaves = 0.5;
+        else if (flag == "Batched") config.sortedBatches = true;
+        else if (flag == "KeyRange") config.partition = Engine::Partition::KeyRange;
+        else if (flag == "Latency") config.recordLatency = true;
+        else assert(false);
+    }
     MetaEngine(type, "", Cases, config);
     return 0;
 }
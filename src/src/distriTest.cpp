@@ -2,15 +2,119 @@
 #include "engine.hpp"
 #include "distriTree/distriTree.hpp"
 
+/**
+ * One rank writes a replicated range and reads all of it back before waiting for any result, so
+ * several request batches worth of gets are outstanding for it. Gets a replica is too stale for
+ * go on to the owner, which may hold them until the writes arrive and answer them together.
+ */
+bool ReadBurst(MPI_Comm world) {
+    constexpr int numKeys = 3000, rounds = 4;
+    int rank, size;
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm_size(world, &size);
+
+    bool pass = true;
+    {
+        Tree::DistriBPlusTree<int> tree(4, world, 0, numKeys - 1, 2, Tree::RemoteRead::Messages);
+        int ownedByFirst = numKeys / size;
+        tree.replicate(0, ownedByFirst, size);
+        if (rank == size - 1) {
+            for (int round = 0; round < rounds; round ++) {
+                for (int key = round; key < ownedByFirst; key += rounds) tree.insert(key);
+                std::vector<Tree::DistriBPlusTree<int>::GetHandle> handles;
+                for (int key = 0; key < ownedByFirst; key ++) handles.push_back(tree.get_async(key));
+                for (int key = 0; key < ownedByFirst; key ++) {
+                    std::optional<int> result = handles[key].wait();
+                    if (result.has_value() != (key % rounds <= round)) pass = false;
+                }
+            }
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &pass, 1, MPI_CXX_BOOL, MPI_LAND, world);
+    return pass;
+}
+
+/**
+ * Every rank inserts its own keys, removes them and inserts as many new ones, so its mirror takes
+ * more keys over time than the 3/4 of its slots that would disable it. Reads of the other ranks'
+ * keys must all be right and answered from the mirrors. Then the live keys alone overfill the
+ * mirrors, and the reads must still be right.
+ */
+bool MirrorChurn(MPI_Comm world, Tree::RemoteRead remoteReads) {
+    const int half = static_cast<int>(Tree::DistriMirrorSlots) * 5 / 8;
+    int rank, size;
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm_size(world, &size);
+
+    bool pass = true;
+    {
+        Tree::DistriBPlusTree<int> tree(4, world, 0, size * 2 * half - 1, 1, remoteReads);
+        int low = rank * 2 * half;
+        assert(tree.ownerOf(low) == rank && tree.ownerOf(low + 2 * half - 1) == rank);
+        // Remote reads of every few keys of the other ranks, the ones below cutoff are expected gone
+        auto readOthers = [&](int cutoff) {
+            uint64_t reads = 0, hitsBefore = tree.numMirrorHits();
+            for (int peer = 0; peer < size; peer ++) {
+                if (peer == rank) continue;
+                for (int offset = 0; offset < 2 * half; offset += 41, reads ++) {
+                    if (tree.get(peer * 2 * half + offset).has_value() != (offset >= cutoff)) pass = false;
+                }
+            }
+            return tree.numMirrorHits() - hitsBefore == reads;
+        };
+
+        for (int key = low; key < low + half; key ++) tree.insert(key);
+        for (int key = low; key < low + half; key ++) tree.remove(key);
+        for (int key = low + half; key < low + 2 * half; key ++) tree.insert(key);
+        MPI_Barrier(world);
+        if (!readOthers(half)) pass = false;
+        MPI_Barrier(world);
+
+        for (int key = low; key < low + half; key ++) tree.insert(key);
+        MPI_Barrier(world);
+        readOthers(0);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &pass, 1, MPI_CXX_BOOL, MPI_LAND, world);
+    return pass;
+}
+
+static int usage(int rank) {
+    if (rank == 0) {
+        std::cerr << "Usage: distributeTree [case [Rebalance] [Replicate] [OneSided] [Scan]]" << std::endl
+                  << "       distributeTree ReadBurst" << std::endl
+                  << "       distributeTree MirrorChurn [OneSided]" << std::endl;
+    }
+    MPI_Finalize();
+    return 1;
+}
+
+/**
+ * Usage: distributeTree [case [flags...]] | distributeTree ReadBurst | distributeTree MirrorChurn [OneSided]
+ * Without a case, benchmark the B_mega cases over a prefilled tree. With one (looked up under
+ * ../test/ unless given as a path), run it on an empty tree and check every GET against the case.
+ * ReadBurst and MirrorChurn run the scenarios above instead of a case, MirrorChurn reads the
+ * mirrors of the same node by default and through the RMA window with OneSided.
+ * Optional flags after the case name:
+ *  "Rebalance" - rebalance every 100 entries, over a tree whose case keys all start on rank 0
+ *  "Replicate" - copy the case's key range to every rank, each owner its own part
+ *  "OneSided"  - read remote owners through the one-sided RMA window
+ *  "Scan"      - also scan the case's key range at every BARRIER
+ */
 int main(int argc, char *argv[]) {
     std::vector<std::string> Cases = {};
-    for (int i = 0; i < 3; i ++) {
-        std::string s = "../test/B_megaGet_" + std::to_string(i) + ".case";
-        Cases.push_back(s);
-    }
-    for (int i = 0; i < 3; i ++) {
-        std::string s = "../test/B_megaMix_" + std::to_string(i) + ".case";
-        Cases.push_back(s);
+    bool checked = argc > 1;
+    if (checked) {
+        std::string caseName = argv[1];
+        Cases.push_back(caseName.find('/') == std::string::npos ? "../test/" + caseName : caseName);
+    } else {
+        for (int i = 0; i < 3; i ++) {
+            std::string s = "../test/B_megaGet_" + std::to_string(i) + ".case";
+            Cases.push_back(s);
+        }
+        for (int i = 0; i < 3; i ++) {
+            std::string s = "../test/B_megaMix_" + std::to_string(i) + ".case";
+            Cases.push_back(s);
+        }
     }
 
     int mpi_thread_support;
@@ -21,8 +125,41 @@ int main(int argc, char *argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+    std::string scenario = checked ? argv[1] : "";
+    if (scenario == "ReadBurst" || scenario == "MirrorChurn") {
+        bool oneSided = scenario == "MirrorChurn" && argc == 3 && std::string(argv[2]) == "OneSided";
+        if (argc > 3 || (argc == 3 && !oneSided)) return usage(rank);
+        bool pass = scenario == "ReadBurst" ? ReadBurst(MPI_COMM_WORLD)
+                                            : MirrorChurn(MPI_COMM_WORLD, oneSided ? Tree::RemoteRead::OneSided
+                                                                                   : Tree::RemoteRead::NodeShared);
+        if (rank == 0 && pass) std::cout << "\033[1;32mPASS " << scenario << "\033[0m" << std::endl;
+        if (rank == 0 && !pass) std::cout << "\033[1;31mFAIL " << scenario << "\033[0m" << std::endl;
+        MPI_Finalize();
+        return pass ? 0 : 1;
+    }
+
     {
         Engine::EngineConfig sequentialCfg {5, 1, 1, Cases, std::make_pair(100000, 900000)};
+        if (checked) {
+            sequentialCfg.prefill = std::nullopt;
+            sequentialCfg.numWorker = 2;
+            sequentialCfg.checkResults = true;
+        }
+        for (int arg = 2; arg < argc; arg ++) {
+            std::string flag = argv[arg];
+            if (flag == "Rebalance") {
+                // Keys above the case's own, so rank 0 owns every key the case touches and is split
+                sequentialCfg.prefill = std::make_pair(1000, 4000);
+                sequentialCfg.rebalanceEvery = 100;
+            } else if (flag == "Replicate") {
+                sequentialCfg.replicateCase = true;
+                sequentialCfg.replicaCopies = size;
+            } else if (flag == "OneSided") {
+                sequentialCfg.remoteReads = Tree::RemoteRead::OneSided;
+            } else if (flag == "Scan") {
+                sequentialCfg.checkScans = true;
+            } else return usage(rank);
+        }
         auto engine = Engine::DistributeEngine(sequentialCfg, MPI_COMM_WORLD);
         engine.Run();
     }
@@ -0,0 +1,24 @@
+#include <iostream>
+#include "utility/TraceFile.h"
+
+/**
+ * Converts a text test case (.case) into the binary trace format (.bcase) that the engines map
+ * directly. Usage: traceConvert <input.case> <output.bcase>
+ */
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.case> <output.bcase>" << std::endl;
+        return 1;
+    }
+    std::vector<TraceRecord> records;
+    if (!readTextTrace(argv[1], records)) {
+        std::cerr << "Unable to parse case at " << argv[1] << std::endl;
+        return 1;
+    }
+    if (!writeBinaryTrace(argv[2], records)) {
+        std::cerr << "Unable to write trace at " << argv[2] << std::endl;
+        return 1;
+    }
+    std::cout << "Converted " << records.size() << " records to " << argv[2] << std::endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 import random
+import struct
 
 class Trace:
     def __init__(self, op, key, expect):
@@ -50,11 +51,30 @@ class CaseGenerator:
             self.trace.append(str(proposed))
             self.execLine(proposed)
         
-        with open(self.fileName, "w") as f:
-            f.write("\n".join(self.trace))
+        if self.fileName.endswith(".bcase"):
+            writeBinary(self.fileName, [Trace.deserialize(line) for line in self.trace])
+        else:
+            with open(self.fileName, "w") as f:
+                f.write("\n".join(self.trace))
         print(f"Finish generate:\t{self.fileName}")
 
 
+# Binary trace (.bcase), must match includes/utility/TraceFile.h
+BINARY_OP = {"I": 0, "D": 1, "G": 2, "BARRIER": 3}
+
+def writeBinary(fileName, traces):
+    with open(fileName, "wb") as f:
+        f.write(struct.pack("=4sIQ", b"BFTR", 1, len(traces)))
+        for t in traces:
+            key = 0 if t.op == "BARRIER" else t.key
+            f.write(struct.pack("=iBBHi", key, BINARY_OP[t.op], t.expect is not None, 0,
+                                0 if t.expect is None else t.expect))
+
+def convertCase(caseName, binaryName):
+    with open(caseName, "r") as f: lines = f.read().strip().split("\n")
+    writeBinary(binaryName, [Trace.deserialize(line) for line in lines])
+
+
 # for i in range(0, 10):
 #     CaseGenerator(1000, 10, 50, f"small_{i}.case", [.5, .2, .2, .1]).generate()
 #     CaseGenerator(100000, 1000, 5000, f"large_{i}.case", [.6, .29, .1, .01]).generate()
@@ -65,13 +85,27 @@ class CaseGenerator:
 # for i in range(3):
 #     CaseGenerator(1000000, 0, 1000000, f"mega_{i}.case", [.05, .05, .89, .01]).generate()
 
-prefiled = {_ for _ in range(100000, 900000)}
-for i in range(0, 3):
-    CaseGenerator(
-        1000000, 0, 1000000, f"B_megaGet_{i}.case", [.01, .01, .98, .0], prefiled
-    ).generate()
+def generateBenchmark():
+    prefiled = {_ for _ in range(100000, 900000)}
+    for i in range(0, 3):
+        CaseGenerator(
+            1000000, 0, 1000000, f"B_megaGet_{i}.case", [.01, .01, .98, .0], set(prefiled)
+        ).generate()
+
+    for i in range(0, 3):
+        CaseGenerator(
+            1000000, 0, 1000000, f"B_megaMix_{i}.case", [.1, .1, .8, .0], set(prefiled)
+        ).generate()
+
+
+# The cases are generated, not checked in. CMake makes the ones ctest reads at configure time.
+GENERATORS = {
+    "small_0": lambda: CaseGenerator(1000, 10, 50, "small_0.case", [.5, .2, .2, .1]).generate(),
+    "large_0": lambda: CaseGenerator(100000, 1000, 5000, "large_0.case", [.6, .29, .1, .01]).generate(),
+    "B_mega":  generateBenchmark,
+}
 
-for i in range(0, 3):
-    CaseGenerator(
-        1000000, 0, 1000000, f"B_megaMix_{i}.case", [.1, .1, .8, .0], prefiled
-    ).generate()
+if __name__ == "__main__":
+    import sys
+    for name in sys.argv[1:] or ["B_mega"]:
+        GENERATORS[name]()